@@ -0,0 +1,253 @@
+#! /usr/bin/perl -w
+
+# bench.pl
+#    This program runs every io61 program against every io61 backend
+#    (your io61, stdio, syscall, and slow) over a sweep of file sizes,
+#    block sizes, and strides. It writes the results, one row per run,
+#    to `bench.csv` and `bench.json`.
+#
+#    `make bench` runs it. Environment variables narrow the sweep:
+#
+#    BENCH_PROGRAMS  programs to run (default: all below)
+#    BENCH_BACKENDS  backends (default: "io61 stdio syscall slow")
+#    BENCH_SIZES     input file sizes in bytes
+#    BENCH_BLOCKS    block sizes for programs that take `-b`
+#    BENCH_STRIDES   strides for programs that take `-t`
+#    BENCH_TRIALS    trials per run; the median time is reported
+#    BENCH_TIMEOUT   seconds before a run is killed
+#    BENCH_OUT       output file prefix (default "bench")
+#
+#    To use the matrix as a regression gate, save a `bench.csv` from a
+#    known-good tree and rerun with BENCH_BASELINE set to its name. Runs
+#    whose throughput falls, or whose system call count rises, by more
+#    than BENCH_TOLERANCE (default 0.2, i.e. 20%) are reported, and
+#    bench.pl exits with status 1.
+
+use Time::HiRes;
+use POSIX;
+
+sub env_list ($$) {
+    my ($e, $default) = @_;
+    my ($v) = exists($ENV{$e}) && $ENV{$e} =~ /\S/ ? $ENV{$e} : $default;
+    return split(/[\s,]+/, $v);
+}
+
+# Programs, and which of `-b` and `-t` they take. Every program reads
+# its input file and writes `-o` output.
+my (@PROGRAMS) = (
+    ["cat61", ""], ["read61", ""], ["write61", ""], ["copycat61", ""],
+    ["reverse61", ""], ["wreverse61", ""],
+    ["blockcat61", "b"], ["blockread61", "b"], ["blockwrite61", "b"],
+    ["randblockcat61", "b"], ["reordercat61", "b"],
+    ["peekcat61", "b"], ["iovcat61", "b"],
+    ["stridecat61", "bt"], ["wstridecat61", "bt"]
+);
+my (%wanted) = map { $_ => 1 } env_list("BENCH_PROGRAMS", join(" ", map { $_->[0] } @PROGRAMS));
+@PROGRAMS = grep { $wanted{$_->[0]} } @PROGRAMS;
+
+my (@BACKENDS) = env_list("BENCH_BACKENDS", "io61 stdio syscall slow");
+my (@SIZES) = env_list("BENCH_SIZES", "65536 4194304");
+my (@BLOCKS) = env_list("BENCH_BLOCKS", "1 512 8192");
+my (@STRIDES) = env_list("BENCH_STRIDES", "1024 65536");
+my ($TRIALS) = (env_list("BENCH_TRIALS", "3"))[0];
+my ($TIMEOUT) = (env_list("BENCH_TIMEOUT", "10"))[0];
+my ($OUT) = (env_list("BENCH_OUT", "bench"))[0];
+my ($BASELINE) = (env_list("BENCH_BASELINE", ""))[0];
+my ($TOLERANCE) = (env_list("BENCH_TOLERANCE", "0.2"))[0];
+
+my (@FIELDS) = qw(program backend size block stride status time utime stime
+                  maxrss mbps syscr syscw reads writes seeks cache_hits
+                  cache_misses);
+
+# make_input($size)
+#    Return the name of a `$size`-byte input file, creating it if needed.
+sub make_input ($) {
+    my ($size) = @_;
+    my ($fn) = "inputs/bench$size.bin";
+    return $fn if -r $fn && -s $fn == $size;
+    mkdir("inputs");
+    open(URANDOM, "<", "/dev/urandom") or die "/dev/urandom: $!\n";
+    open(INPUT, ">", $fn) or die "$fn: $!\n";
+    for (my $n = 0; $n < $size; $n += 65536) {
+        my ($buf);
+        read(URANDOM, $buf, $size - $n < 65536 ? $size - $n : 65536);
+        print INPUT $buf;
+    }
+    close(INPUT);
+    close(URANDOM);
+    return $fn;
+}
+
+# run_once($command)
+#    Run `$command` with the profiler's report on fd 100, killing it
+#    after `$TIMEOUT` seconds. Returns a hash of the reported values.
+sub run_once ($) {
+    my ($command) = @_;
+    pipe(PR, PW) or die "pipe";
+    my ($before) = Time::HiRes::time();
+    my ($pid) = fork();
+    if ($pid == 0) {
+        close(PR);
+        POSIX::dup2(fileno(PW), 100);
+        close(PW);
+        open(STDIN, "<", "/dev/null");
+        open(STDOUT, ">", "/dev/null");
+        # The alarm survives `exec` and kills a run that takes too long.
+        alarm($TIMEOUT);
+        { exec($command) };
+        exit(127);
+    }
+    close(PW);
+    my ($buf) = "";
+    while (sysread(PR, $buf, 65536, length($buf))) {
+    }
+    close(PR);
+    waitpid($pid, 0);
+    my ($t) = {"time" => Time::HiRes::time() - $before};
+    if (WIFSIGNALED($?) && WTERMSIG($?) == SIGALRM) {
+        $t->{"status"} = "timeout";
+    } elsif ($? != 0) {
+        $t->{"status"} = "error";
+    } else {
+        $t->{"status"} = "ok";
+    }
+    $buf =~ s/,?\s*\"files\"\s*:\s*\[.*?\]//s;
+    while ($buf =~ m,\"(.*?)\"\s*:\s*([\d.]+),g) {
+        $t->{$1} = $2;
+    }
+    return $t;
+}
+
+# run_median($command)
+#    Run `$command` `$TRIALS` times; return the run with median time.
+#    Stops early if a run fails.
+sub run_median ($) {
+    my ($command) = @_;
+    my (@runs);
+    for (my $i = 0; $i < $TRIALS; ++$i) {
+        my ($t) = run_once($command);
+        push @runs, $t;
+        return $t if $t->{"status"} ne "ok";
+    }
+    @runs = sort { $a->{"time"} <=> $b->{"time"} } @runs;
+    return $runs[int(@runs / 2)];
+}
+
+sub csv_row (@) {
+    return join(",", map { defined($_) ? $_ : "" } @_) . "\n";
+}
+
+sub json_value ($) {
+    my ($v) = @_;
+    return "null" if !defined($v);
+    return $v if $v =~ /\A-?\d+(?:\.\d+)?\z/;
+    return "\"$v\"";
+}
+
+sub run_key ($) {
+    my ($t) = @_;
+    return join(",", map { defined($t->{$_}) ? $t->{$_} : "" }
+                qw(program backend size block stride));
+}
+
+# read_baseline($fn)
+#    Read a CSV written by an earlier run into a hash keyed by run_key.
+sub read_baseline ($) {
+    my ($fn) = @_;
+    my (%base);
+    open(BASE, "<", $fn) or die "$fn: $!\n";
+    my (@header) = split(/,/, scalar(<BASE>), -1);
+    chomp @header;
+    while (defined(my $line = <BASE>)) {
+        chomp $line;
+        my (%row);
+        @row{@header} = split(/,/, $line, -1);
+        $base{run_key(\%row)} = \%row;
+    }
+    close(BASE);
+    return \%base;
+}
+
+# regressions($t, $base)
+#    Return descriptions of the ways run `$t` is worse than `$base`.
+sub regressions ($$) {
+    my ($t, $base) = @_;
+    my (@r);
+    if ($base->{"status"} eq "ok" && $t->{"status"} ne "ok") {
+        push @r, "status " . $t->{"status"};
+    }
+    if ($base->{"mbps"} ne "" && defined($t->{"mbps"})
+        && $t->{"mbps"} < $base->{"mbps"} * (1 - $TOLERANCE)) {
+        push @r, sprintf("throughput %.2f MB/s, was %.2f", $t->{"mbps"}, $base->{"mbps"});
+    }
+    if ($base->{"syscr"} ne "" && defined($t->{"syscr"})) {
+        my ($was) = $base->{"syscr"} + $base->{"syscw"};
+        my ($now) = $t->{"syscr"} + $t->{"syscw"};
+        push @r, "$now system calls, was $was" if $now > $was * (1 + $TOLERANCE);
+    }
+    return @r;
+}
+
+my ($baseline) = $BASELINE ? read_baseline($BASELINE) : undef;
+my ($nregressions) = 0;
+
+mkdir("outputs");
+open(CSV, ">", "$OUT.csv") or die "$OUT.csv: $!\n";
+open(JSON, ">", "$OUT.json") or die "$OUT.json: $!\n";
+print CSV csv_row(@FIELDS);
+print JSON "[";
+my ($nrows) = 0;
+
+foreach my $size (@SIZES) {
+    my ($input) = make_input($size);
+    foreach my $p (@PROGRAMS) {
+        my ($prog, $takes) = @$p;
+        my (@blocks) = $takes =~ /b/ ? @BLOCKS : (undef);
+        my (@strides) = $takes =~ /t/ ? @STRIDES : (undef);
+        foreach my $block (@blocks) {
+            foreach my $stride (@strides) {
+                my ($args) = "";
+                $args .= " -b $block" if defined($block);
+                $args .= " -t $stride" if defined($stride);
+                foreach my $backend (@BACKENDS) {
+                    my ($exe) = $backend eq "io61" ? $prog : "$backend-$prog";
+                    die "$exe: not built; run `make bench`\n" if !-x $exe;
+                    my ($t) = run_median("./$exe$args -o outputs/bench.out $input");
+                    $t->{"program"} = $prog;
+                    $t->{"backend"} = $backend;
+                    $t->{"size"} = $size;
+                    $t->{"block"} = $block;
+                    $t->{"stride"} = $stride;
+                    if ($t->{"status"} eq "ok" && $t->{"time"} > 0) {
+                        $t->{"mbps"} = sprintf("%.2f", $size / $t->{"time"} / 1e6);
+                    }
+                    $t->{"time"} = sprintf("%.6f", $t->{"time"});
+
+                    print CSV csv_row(map { $t->{$_} } @FIELDS);
+                    print JSON ($nrows ? ",\n " : "\n "), "{",
+                        join(", ", map { "\"$_\":" . json_value($t->{$_}) } @FIELDS),
+                        "}";
+                    ++$nrows;
+                    printf("%-14s %-7s %9d%-18s %8s %10s MB/s %8s syscalls\n",
+                           $prog, $backend, $size, $args, $t->{"status"},
+                           defined($t->{"mbps"}) ? $t->{"mbps"} : "-",
+                           defined($t->{"syscr"}) ? $t->{"syscr"} + $t->{"syscw"} : "-");
+                    my ($base) = $baseline ? $baseline->{run_key($t)} : undef;
+                    foreach my $r ($base ? regressions($t, $base) : ()) {
+                        print "    REGRESSION: $r\n";
+                        ++$nregressions;
+                    }
+                }
+            }
+        }
+    }
+}
+
+print JSON "\n]\n";
+close(CSV);
+close(JSON);
+print "$nrows runs written to $OUT.csv and $OUT.json\n";
+if ($baseline) {
+    print "$nregressions regressions against $BASELINE\n";
+    exit($nregressions ? 1 : 0);
+}
@@ -279,12 +279,39 @@ sub run_sh61 ($;%) {
         return $answer;
     }
 
-    $nb = POSIX::read(fileno(PR), $buf, 2000);
+    $nb = POSIX::read(fileno(PR), $buf, 65536);
     close(PR);
     $buf = $nb > 0 ? substr($buf, 0, $nb) : "";
 
-    while ($buf =~ m,\"(.*?)\"\s*:\s*([\d.]+),g) {
-        $answer->{$1} = $2;
+    # Each profiled process in a pipeline writes one record per line.
+    # Combine them: elapsed time and memory take the maximum, CPU time
+    # and I/O counters add up.
+    my(%stats);
+    foreach my $rec (split(/\n/, $buf)) {
+        if ($rec =~ s/,?\s*\"files\"\s*:\s*\[(.*?)\]//s) {
+            my($files) = $1;
+            $answer->{"files"} = [] if !exists($answer->{"files"});
+            while ($files =~ m,\{(.*?)\},gs) {
+                my($fstr, $fstat) = ($1, {});
+                while ($fstr =~ m,\"(.*?)\"\s*:\s*([\d.]+),g) {
+                    $fstat->{$1} = $2;
+                }
+                push @{$answer->{"files"}}, $fstat;
+            }
+        }
+        while ($rec =~ m,\"(.*?)\"\s*:\s*([\d.]+),g) {
+            my($k, $v) = ($1, $2);
+            if (!defined($stats{$k})) {
+                $stats{$k} = $v;
+            } elsif ($k eq "time" || $k eq "maxrss") {
+                $stats{$k} = $v if $v > $stats{$k};
+            } else {
+                $stats{$k} += $v;
+            }
+        }
+    }
+    while (my($k, $v) = each %stats) {
+        $answer->{$k} = $v;
     }
     $answer->{"time"} = $delta if !defined($answer->{"time"});
     $answer->{"time"} = $delta if $answer->{"time"} <= 0.95 * $delta;
@@ -771,6 +798,7 @@ sub print_stdio ($) {
         printf("%.5fs (%.5fs user, %.5fs system, %.0fMiB memory, %d trial%s)\n",
                $t->{"time"}, $t->{"utime"}, $t->{"stime"}, $maxrss / 1024.0,
                $t->{"medianof"}, $t->{"medianof"} == 1 ? "" : "s");
+        print_io($t);
     } else {
         printf("${Red}KILLED${Redctx} after %.5fs (%d trial%s)${Off}\n",
                $t->{"time"},
@@ -778,6 +806,25 @@ sub print_stdio ($) {
     }
 }
 
+sub io_summary ($) {
+    my ($s) = @_;
+    sprintf("%d reads (%.1fMiB), %d writes (%.1fMiB), %d seeks, %d flushes, %d hits, %d misses",
+            $s->{"reads"}, $s->{"bytes_read"} / 1048576.0,
+            $s->{"writes"}, $s->{"bytes_written"} / 1048576.0,
+            $s->{"seeks"}, $s->{"flushes"},
+            $s->{"cache_hits"}, $s->{"cache_misses"});
+}
+
+sub print_io ($) {
+    my ($t) = @_;
+    return if !exists($t->{"reads"})
+        || !grep { $t->{$_} } qw(reads writes seeks cache_hits cache_misses);
+    print "IO:        ", io_summary($t), "\n";
+    foreach my $fs (@{$t->{"files"} || []}) {
+        printf("           fd %d: %s\n", $fs->{"fd"}, io_summary($fs));
+    }
+}
+
 sub check_trial_errors ($$) {
     my ($tt, $qitem) = @_;
     my ($error) = 0;
@@ -901,6 +948,7 @@ sub run () {
             printf("%.5fs (%.5fs user, %.5fs system, %.0fMiB memory, %d trial%s)\n",
                $tt->{"time"}, $tt->{"utime"}, $tt->{"stime"}, $tt->{"maxrss"} / 1024.0,
                $tt->{"medianof"}, $tt->{"medianof"} == 1 ? "" : "s");
+            print_io($tt);
             push @runtimes, $tt->{"time"};
         }
 
@@ -1016,6 +1064,7 @@ sub summary () {
     "MAKESILENT" => boolenv("MAKESILENT"),
     "NOMAKE" => boolenv("NOMAKE"),
     "STRACE" => boolenv("STRACE"),
+    "HUGE" => boolenv("HUGE"),
     "TMP" => nonemptyenv("TMP") ? boolenv("TMP") : undef
 );
 
@@ -1127,6 +1176,7 @@ my ($revtextsm) = register_file("inputs/text90k-rev.txt", 3 << 9);
 my ($binsm) = register_file("inputs/binary3m.bin", 4 << 9);
 my ($textmd) = register_file("inputs/text10m.txt", 5 << 9);
 my ($textlg) = register_file("inputs/text64m.txt", 6 << 9);
+my ($texthuge) = register_file("inputs/text1g.txt", 7 << 9);
 
 $SIG{"INT"} = sub {
     kill 9, -$run61_pid if $run61_pid;
@@ -1247,6 +1297,46 @@ enqueue("C22",
     "unmappable file, byte I/O, reverse order",
     "perf" => 0, "compare" => -1, "insize" => 4096);
 
+enqueue("C23",
+    "cat $textsm | ./peekcat61 -b 1021 | cat > outputs/out.txt",
+    "1021B borrowed block I/O, piped, sequential correctness",
+    "perf" => 0, "expect" => $textsm);
+
+enqueue("C24",
+    "cat $textsm | ./copycat61 | cat > outputs/out.txt",
+    "kernel copy, piped, sequential correctness",
+    "perf" => 0, "expect" => $textsm);
+
+enqueue("C25",
+    "./copycat61 -s 1992 -o outputs/c25.txt $textsm",
+    "kernel copy, sized, sequential correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("C26",
+    "cat $textsm | ./iovcat61 -b 1021 | cat > outputs/out.txt",
+    "1021B vectored block I/O, piped, sequential correctness",
+    "perf" => 0, "expect" => $textsm);
+
+enqueue("C27",
+    "./carefulcat61 -a 0.001 $textsm | ./pollcat61 -b 1021 | ./carefulcat61 -a 0.001 > outputs/out.txt",
+    "1021B non-blocking block I/O, short-piped, sequential correctness",
+    "perf" => 0, "expect" => $textsm);
+
+enqueue("C28",
+    "./pollcat61 -b 509 -i $textsm -o outputs/c28a.txt -i $binsm -o outputs/c28b.txt",
+    "non-blocking copy of 2 files, 509B block I/O, sequential",
+    "perf" => 0, "compare" => 1);
+
+enqueue("C29",
+    "./scattergather61 -j 4 -b 509 -o outputs/c29a.txt -o outputs/c29b.txt -o outputs/c29c.txt -o outputs/c29d.txt -i $textsm -i $revtextsm -i $binsm",
+    "threaded scatter/gather 4/3 files, 509B block I/O, sequential",
+    "perf" => 0, "compare" => 1);
+
+enqueue("C30",
+    "cat $textsm | ./scattergather61 -j 2 -b 128 -l -o outputs/c30a.txt -o outputs/c30b.txt -i $revtextsm -i /dev/stdin",
+    "threaded scatter/gather 2/2 files by lines, piped, sequential",
+    "perf" => 0, "compare" => 1);
+
 
 # REGULAR FILES, SEQUENTIAL I/O
 enqueue("MSEQ1",
@@ -1338,6 +1428,46 @@ enqueue("LSEQ9",
     "./randblockcat61 $textlg > outputs/out.txt",
     "redirected large file, 1B-4KB block I/O, sequential");
 
+enqueue("LSEQ10",
+    "./cat61 -R 8 -o outputs/out.txt $textlg",
+    "regular large file, byte I/O, sequential, 8-block read-ahead");
+
+enqueue("LSEQ11",
+    "./scattergather61 -b 4096 -l -o outputs/out.txt $textlg",
+    "regular large file, line I/O, sequential");
+
+enqueue("LSEQ12",
+    "./peekcat61 -o outputs/out.txt $textlg",
+    "regular large file, 4KB borrowed block I/O, sequential");
+
+enqueue("LSEQ13",
+    "./copycat61 -o outputs/out.txt $textlg",
+    "regular large file, kernel copy, sequential");
+
+enqueue("LSEQ14",
+    "./copycat61 $textlg | cat > outputs/out.txt",
+    "piped large file, kernel copy, sequential");
+
+enqueue("LSEQ15",
+    "./iovcat61 -o outputs/out.txt $textlg",
+    "regular large file, 4KB vectored block I/O, sequential");
+
+enqueue("LSEQ16",
+    "cat $textlg | ./iovcat61 -b 65536 | cat > outputs/out.txt",
+    "piped large file, 64KB vectored block I/O, sequential");
+
+enqueue("LSEQ17",
+    "./cat61 -U -o outputs/out.txt $textlg",
+    "regular large file, byte I/O, sequential, O_DIRECT");
+
+enqueue("LSEQ18",
+    "./blockcat61 -U -o outputs/out.txt $textlg",
+    "regular large file, 4KB block I/O, sequential, O_DIRECT");
+
+enqueue("LSEQ19",
+    "cat $textlg | ./pollcat61 | cat > outputs/out.txt",
+    "piped large file, 4KB non-blocking block I/O, sequential");
+
 enqueue("LNONSEQ1",
     "./reverse61 -s 8388608 -o outputs/out.txt $textlg",
     "regular large file, byte I/O, reverse order");
@@ -1351,6 +1481,25 @@ enqueue("LNONSEQ3",
     "regular large file, 4KB block I/O, random seek order");
 
 
+# HUGE FILES
+#    These need a 1 GiB input, so they run only with HUGE=1
+#    (`make check-huge`).
+
+if ($param{"HUGE"}) {
+    enqueue("HSEQ1",
+        "./blockcat61 -o outputs/out.txt $texthuge",
+        "regular huge file, 4KB block I/O, sequential");
+
+    enqueue("HSEQ2",
+        "./blockcat61 -U -o outputs/out.txt $texthuge",
+        "regular huge file, 4KB block I/O, sequential, O_DIRECT");
+
+    enqueue("HSEQ3",
+        "./cat61 -U -o outputs/out.txt $texthuge",
+        "regular huge file, byte I/O, sequential, O_DIRECT");
+}
+
+
 run();
 
 summary();
@@ -0,0 +1,25 @@
+#include "io61.hh"
+
+// Usage: ./copycat61 [-s SIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE with io61_copy, which can move the
+//    data inside the kernel.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("s:o:i:").parse(argc, argv);
+
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+
+    while (args.file_size != 0) {
+        ssize_t n = io61_copy(inf, outf, args.file_size);
+        if (n <= 0) {
+            break;
+        }
+        args.file_size -= n;
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+}
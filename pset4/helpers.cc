@@ -2,13 +2,15 @@
 #include <ctime>
 #include <csignal>
 #include <cerrno>
+#include <climits>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <string>
 
 // helpers.cc
 //    The io61_args() structure parses command line arguments.
 //    The profile functions measure how much time and memory are used
-//    by your code.
+//    by your code. io61_poll and io61_wait are shared by all backends.
 
 
 // fd_open_check(filename, mode)
@@ -46,6 +48,85 @@ FILE* stdio_open_check(const char* filename, int mode) {
 }
 
 
+// io61_poll(fds, nfds, timeout), io61_wait(f, events, timeout)
+//    Like `poll` for io61 files. io61_poll waits up to `timeout`
+//    milliseconds (-1 means forever) until some file in `fds` is ready
+//    for its `events`, sets every `revents`, and returns the number of
+//    ready files, 0 on timeout, or -1 on error. Files that io61 can serve
+//    from its cache count as ready, and if there are any, io61_poll
+//    returns them without a system call. io61_wait waits for one file and
+//    returns its ready events.
+//
+//    These use only io61_ready and io61_fileno, so every backend links
+//    this one copy and supplies just io61_ready.
+
+int io61_poll(io61_pollfd* fds, size_t nfds, int timeout) {
+    std::vector<pollfd> pfds(nfds);
+    int nready = 0;
+    for (size_t i = 0; i != nfds; ++i) {
+        fds[i].revents = io61_ready(fds[i].f, fds[i].events);
+        nready += fds[i].revents != 0;
+        pfds[i] = {io61_fileno(fds[i].f), fds[i].events, 0};
+    }
+    if (nready != 0) {
+        return nready;
+    } else if (poll(pfds.data(), nfds, timeout) == -1) {
+        return -1;
+    }
+    for (size_t i = 0; i != nfds; ++i) {
+        fds[i].revents |= pfds[i].revents;
+        nready += fds[i].revents != 0;
+    }
+    return nready;
+}
+
+int io61_wait(io61_file* f, int events, int timeout) {
+    io61_pollfd p = {f, (short) events, 0};
+    int r = io61_poll(&p, 1, timeout);
+    return r > 0 ? p.revents : r;
+}
+
+
+// io61 parameters and statistics
+
+io61_params io61_defaults;
+io61_stats io61_totals;
+static std::vector<std::pair<int, io61_stats>> io61_file_stats;
+
+io61_stats& io61_stats::operator+=(const io61_stats& x) {
+    this->reads += x.reads;
+    this->writes += x.writes;
+    this->seeks += x.seeks;
+    this->bytes_read += x.bytes_read;
+    this->bytes_written += x.bytes_written;
+    this->cache_hits += x.cache_hits;
+    this->cache_misses += x.cache_misses;
+    this->flushes += x.flushes;
+    return *this;
+}
+
+void io61_record_stats(int fd, const io61_stats& stats) {
+    io61_totals += stats;
+    // Bound memory use; `io61_profile_end` drops entries that would not
+    // fit in its report.
+    if (io61_file_stats.size() < 64) {
+        io61_file_stats.emplace_back(fd, stats);
+    }
+}
+
+// io61_stats_json(s)
+//    Returns the counters in `s` as comma-separated JSON members.
+
+static std::string io61_stats_json(const io61_stats& s) {
+    char buf[400];
+    snprintf(buf, sizeof(buf),
+        "\"reads\":%zu, \"writes\":%zu, \"seeks\":%zu, \"bytes_read\":%zu, \"bytes_written\":%zu, \"cache_hits\":%zu, \"cache_misses\":%zu, \"flushes\":%zu",
+        s.reads, s.writes, s.seeks, s.bytes_read, s.bytes_written,
+        s.cache_hits, s.cache_misses, s.flushes);
+    return buf;
+}
+
+
 // monotonic_timestamp()
 //    Returns the current monotonic timestamp.
 
@@ -84,9 +165,13 @@ io61_args& io61_args::parse(int argc, char** argv) {
     size_t block_size_ = this->block_size;
     double alarm_interval = 0;
 
+    // `-C`, `-R`, and `-U` are accepted by every program.
+    std::string optstring = this->opts;
+    optstring += "C:R:U";
+
     int arg;
     char* endptr;
-    while ((arg = getopt(argc, argv, this->opts)) != -1) {
+    while ((arg = getopt(argc, argv, optstring.c_str())) != -1) {
         switch (arg) {
         case 's':
             this->file_size = (size_t) strtoul(optarg, &endptr, 0);
@@ -118,6 +203,12 @@ io61_args& io61_args::parse(int argc, char** argv) {
         case 'n':
             this->nonblocking = true;
             break;
+        case 'j':
+            this->threads = (size_t) strtoul(optarg, &endptr, 0);
+            if (this->threads == 0 || endptr == optarg || *endptr) {
+                goto usage;
+            }
+            break;
         case 'q':
             this->quiet = true;
             break;
@@ -159,6 +250,33 @@ io61_args& io61_args::parse(int argc, char** argv) {
                 goto usage;
             }
             break;
+        case 'C': {
+            // `-C SLOTS` or `-C SLOTSxSIZE`
+            size_t nslots = (size_t) strtoul(optarg, &endptr, 0);
+            size_t slotsz = io61_defaults.cache_slot_size;
+            if (endptr != optarg && *endptr == 'x') {
+                const char* s = endptr + 1;
+                slotsz = (size_t) strtoul(s, &endptr, 0);
+                if (endptr == s) {
+                    goto usage;
+                }
+            }
+            if (nslots == 0 || slotsz == 0 || endptr == optarg || *endptr) {
+                goto usage;
+            }
+            io61_defaults.cache_slots = nslots;
+            io61_defaults.cache_slot_size = slotsz;
+            break;
+        }
+        case 'R':
+            io61_defaults.readahead = (size_t) strtoul(optarg, &endptr, 0);
+            if (endptr == optarg || *endptr) {
+                goto usage;
+            }
+            break;
+        case 'U':
+            io61_defaults.direct = true;
+            break;
         case '#':
         default:
             goto usage;
@@ -235,6 +353,9 @@ void io61_args::usage() {
     if (strchr(this->opts, 'l')) {
         fprintf(stderr, "    -l            Output by lines\n");
     }
+    if (strchr(this->opts, 'j')) {
+        fprintf(stderr, "    -j N          Copy with N worker threads\n");
+    }
     if (strchr(this->opts, 'F')) {
         fprintf(stderr, "    -F            Flush after each write\n");
     }
@@ -253,6 +374,11 @@ void io61_args::usage() {
     if (strchr(this->opts, 'a')) {
         fprintf(stderr, "    -a TIME       Set interval timer\n");
     }
+    fprintf(stderr, "    -C N[xSIZE]   Use N cache slots of SIZE bytes per file (default %zu slots,\n"
+                    "                  sized per file)\n",
+            io61_defaults.cache_slots);
+    fprintf(stderr, "    -R N          Read N cache slots ahead in a helper thread\n");
+    fprintf(stderr, "    -U            Bypass the page cache with O_DIRECT\n");
 }
 
 void io61_args::after_open() {
@@ -354,12 +480,45 @@ io61_profiler::~io61_profiler() {
 #endif
 
     char buf[1000];
-    ssize_t len = snprintf(buf, sizeof(buf),
-        "{\"time\":%.6f, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld}\n",
+    snprintf(buf, sizeof(buf),
+        "{\"time\":%.6f, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld, ",
         real_elapsed,
         usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec,
         usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec,
         maxrss);
+    std::string json = buf + io61_stats_json(io61_totals);
+#if __linux__
+    // The kernel's count of data-transfer system calls covers every
+    // backend, including those that keep no counters of their own.
+    if (FILE* iof = fopen("/proc/self/io", "r")) {
+        unsigned long long syscr = 0, syscw = 0;
+        char line[100];
+        while (fgets(line, sizeof(line), iof)) {
+            sscanf(line, "syscr: %llu", &syscr);
+            sscanf(line, "syscw: %llu", &syscw);
+        }
+        fclose(iof);
+        snprintf(buf, sizeof(buf), ", \"syscr\":%llu, \"syscw\":%llu",
+                 syscr, syscw);
+        json += buf;
+    }
+#endif
+    // Per-file counters follow the totals, in the order files were closed.
+    // Every process in a pipeline shares fd 100, so the record must go out
+    // in one atomic write of at most PIPE_BUF bytes; files that do not fit
+    // are left out of the list (they still count in the totals).
+    json += ", \"files\":[";
+    for (auto& fs : io61_file_stats) {
+        snprintf(buf, sizeof(buf), "%s{\"fd\":%d, ",
+                 &fs != io61_file_stats.data() ? ", " : "", fs.first);
+        std::string entry = buf + io61_stats_json(fs.second) + "}";
+        if (json.size() + entry.size() + 3 > PIPE_BUF) {
+            break;
+        }
+        json += entry;
+    }
+    json += "]}\n";
+    ssize_t len = json.size();
 
     off_t off = lseek(100, 0, SEEK_CUR);
     int fd = (off != (off_t) -1 || errno == ESPIPE ? 100 : STDERR_FILENO);
@@ -369,7 +528,7 @@ io61_profiler::~io61_profiler() {
         fflush(stderr);
     }
     while (true) {
-        ssize_t nw = write(fd, buf, len);
+        ssize_t nw = write(fd, json.data(), len);
         if (nw == len) {
             break;
         }
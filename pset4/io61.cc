@@ -1,41 +1,350 @@
 #include "io61.hh"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#if __linux__
+#include <sys/sendfile.h>
+#endif
 #include <climits>
+#include <algorithm>
 #include <cerrno>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 // io61.cc
 //    YOUR CODE HERE!
 
 
+// io61_slot
+//    One block of cached file data. The slot’s window covers file offsets
+//    [tag, tag + cbufsz); characters in [start_tag, end_tag) are valid.
+//    Read slots always have `start_tag == tag`. Write slots hold a single
+//    contiguous run of dirty characters.
+
+struct io61_slot {
+    unsigned char* buf = nullptr;  // slot memory (allocated on first use)
+    off_t tag = -1;        // file offset of `buf[0]`, or -1 if unused
+    off_t start_tag = -1;  // offset of first valid character
+    off_t end_tag = -1;    // offset one past last valid character
+    bool dirty = false;    // has slot been written?
+    size_t used = 0;       // time of last use (for LRU replacement)
+};
+
+
+// io61_pattern
+//    Access patterns, as detected from the sequence of seeks.
+
+enum io61_pattern {
+    io61_sequential,    // no seeks, or short forward seeks
+    io61_reverse,       // short backward seeks
+    io61_strided,       // constant forward seeks of at least a block
+    io61_random         // anything else
+};
+
+
+// io61_readahead
+//    State shared between an io61_file and its read-ahead thread. The
+//    thread reads the blocks that follow the consumer’s position into
+//    `ready` while the application works on the current block. It only
+//    reads into buffers from `free`, so at most `readahead` blocks are
+//    in flight at once.
+
+struct io61_rablock {
+    unsigned char* buf;    // block data (`cbufsz` bytes)
+    off_t tag;             // file offset of `buf[0]`
+    ssize_t len;           // number of valid bytes (0 at end of file)
+};
+
+struct io61_readahead {
+    std::thread thread;
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<io61_rablock> ready;     // filled blocks, in file order
+    std::vector<unsigned char*> free;   // empty block buffers
+    off_t next_tag;         // file offset the thread reads next
+    unsigned gen = 0;       // incremented when the stream is repositioned
+    bool eof = false;       // thread reached end of file or an error
+    int err = 0;            // `errno` of the thread’s error, if any
+    bool stop = false;      // thread should exit
+    io61_stats stats;       // the thread’s system calls
+};
+
+
 // io61_file
 //    Data structure for io61 file wrappers. Add your own stuff.
 
 struct io61_file {
     int fd = -1;     // file descriptor
     int mode;        // open mode (O_RDONLY or O_WRONLY)
+    bool seekable = false;  // is this file seekable?
+    off_t fd_tag = 0;       // file position of `fd` (seekable files only)
+
+    // Fully associative multi-slot cache with LRU replacement
+    off_t cbufsz;           // bytes per slot
+    off_t cbufmin;          // initial `cbufsz`, restored for scattered access
+    off_t cbufmax;          // `cbufsz` limit for sequential streams
+    int nslots;             // number of slots
+    std::vector<io61_slot> slots;
+    int cur = -1;           // index of loaded slot, or -1
+    int last = 0;           // index of most recently loaded slot
+    size_t clock = 0;       // LRU timestamp source
+
+    // Loaded window: a copy of slot `cur`’s state, or the file mapping
+    unsigned char* cbuf = nullptr;
+    off_t tag = 0;          // file offset of first character in `cbuf`
+    off_t start_tag = 0;    // offset of first valid character in `cbuf`
+    off_t pos_tag = 0;      // next offset to read or write
+    off_t end_tag = 0;      // offset one past last valid character in `cbuf`
+    bool dirty = false;     // has cache been written?
+
+    // Access-pattern detection
+    io61_pattern pattern = io61_sequential;
+    off_t seek_tag = 0;     // target of the previous seek
+    off_t seek_delta = 0;   // distance between the previous two seeks
+
+    // Memory-mapped input (read-only regular files)
+    unsigned char* map = nullptr;  // mapping of the whole file
+    off_t map_size = 0;            // file size when mapped
+
+    // Asynchronous read-ahead (`-R`)
+    io61_readahead* ra = nullptr;
+
+    // Direct I/O (`O_DIRECT` mode or `-U`)
+    int dfd = -1;           // `O_DIRECT` descriptor for aligned transfers
+
+    // Non-blocking mode (`O_NONBLOCK` mode)
+    bool nonblocking = false;  // fail with EAGAIN instead of waiting
+    int saved_flags = -1;      // `fd` status flags to restore, or -1
+
+    // Eager flushing: output is flushed at a newline, at most once per
+    // `flush_interval` nanoseconds (0 means at every newline)
+    bool interactive = false;
+    int64_t flush_interval = 0;
+    int64_t last_flush = 0;     // monotonic time of last newline flush
+
+    // Counters for the profiler (see `io61_record_stats`)
+    io61_stats stats;
 };
 
 
+// Direct I/O parameters: transfer alignment and minimum slot size.
+// Where `O_DIRECT` is missing (macOS), direct I/O is never used.
+
+#ifdef O_DIRECT
+static constexpr int io61_o_direct = O_DIRECT;
+#else
+static constexpr int io61_o_direct = 0;
+#endif
+static constexpr off_t io61_dio_align = 4096;
+static constexpr off_t io61_dio_slot_size = 1 << 20;
+
+// Adaptive slot sizes: smallest and largest sizes for regular files
+
+static constexpr off_t io61_min_slot_size = 8192;
+static constexpr off_t io61_max_slot_size = 1 << 18;
+
+// Pipe and socket output waits at most this long (ns) after a newline
+
+static constexpr int64_t io61_pipe_flush_interval = 1000000;
+
+
 // io61_fdopen(fd, mode)
 //    Returns a new io61_file for file descriptor `fd`. `mode` is either
 //    O_RDONLY for a read-only file or O_WRONLY for a write-only file.
 //    You need not support read/write files.
+//
+//    If `mode` includes O_DIRECT (or `-U` was given), aligned transfers
+//    on regular files bypass the page cache. If `mode` includes
+//    O_NONBLOCK, calls that would wait for a pipe or socket instead
+//    return what they have transferred so far, or -1 with `errno` set to
+//    EAGAIN; use io61_wait or io61_poll to wait for readiness. Otherwise
+//    io61 waits with `poll` when a non-blocking `fd` is not ready.
+
+static void io61_choose_size(io61_file* f);
+static bool io61_direct_open(io61_file* f);
+static void io61_map(io61_file* f);
+static void io61_ra_start(io61_file* f, size_t nblocks);
+static void io61_detach(io61_file* f);
+static int io61_switch(io61_file* f, off_t off);
 
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = new io61_file;
     f->fd = fd;
-    f->mode = mode;
+    f->mode = mode & O_ACCMODE;
+    io61_choose_size(f);
+    f->nslots = io61_defaults.cache_slots;
+    f->slots.resize(f->nslots);
+    off_t off = lseek(fd, 0, SEEK_CUR);
+    ++f->stats.seeks;
+    if (off != -1) {
+        f->seekable = true;
+        f->fd_tag = off;
+    } else {
+        off = 0;
+    }
+    f->pos_tag = f->seek_tag = off;
+    io61_detach(f);
+    if ((mode & io61_o_direct) || io61_defaults.direct) {
+        io61_direct_open(f);
+    }
+    if (mode & O_NONBLOCK) {
+        f->nonblocking = true;
+        int flags = fcntl(fd, F_GETFL);
+        if (flags != -1
+            && !(flags & O_NONBLOCK)
+            && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0) {
+            f->saved_flags = flags;
+        }
+    }
+    if (f->mode == O_RDONLY && f->dfd >= 0) {
+        // Direct reads fill the slots; a mapping would use the page cache.
+    } else if (f->mode == O_RDONLY
+               && io61_defaults.readahead > 0
+               && !f->nonblocking) {
+        // Read-ahead replaces the mapping: page faults on a mapping
+        // would stall the application just like synchronous reads.
+        // Its blocks have a fixed size.
+        f->cbufmin = f->cbufmax = f->cbufsz;
+        io61_ra_start(f, io61_defaults.readahead);
+    } else if (f->mode == O_RDONLY && f->seekable) {
+        io61_map(f);
+    } else if (f->mode != O_RDONLY) {
+        io61_switch(f, off);
+    }
     return f;
 }
 
 
+// io61_choose_size(f)
+//    Choose `f`’s initial slot size and its growth limit from `fstat`,
+//    unless `-C` fixed the slot size. Regular files and block devices
+//    start at their preferred I/O size and may grow to 256 KiB. Pipes and
+//    sockets start small, so output reaches a waiting reader soon; only
+//    their input slots may grow, to the pipe’s capacity. Terminals keep
+//    small slots and are flushed at each newline; pipe and socket output
+//    is flushed at a newline if the last such flush was over a
+//    millisecond ago, which serves an interactive reader without a
+//    system call per line in bulk copies.
+
+static void io61_choose_size(io61_file* f) {
+    struct stat s;
+    if (io61_defaults.cache_slot_size != 0) {
+        f->cbufsz = f->cbufmax = io61_defaults.cache_slot_size;
+    } else if (fstat(f->fd, &s) == -1) {
+        f->cbufsz = f->cbufmax = io61_min_slot_size;
+    } else if (S_ISREG(s.st_mode) || S_ISBLK(s.st_mode)) {
+        f->cbufsz = std::max((off_t) s.st_blksize, io61_min_slot_size);
+        f->cbufmax = std::max(f->cbufsz, io61_max_slot_size);
+    } else if (isatty(f->fd)) {
+        f->cbufsz = f->cbufmax = std::max((off_t) s.st_blksize, (off_t) 1024);
+        f->interactive = f->mode != O_RDONLY;
+    } else {
+        f->cbufsz = std::max((off_t) s.st_blksize, (off_t) 4096);
+        f->cbufmax = std::max(f->cbufsz, (off_t) 65536);
+        if (f->mode != O_RDONLY) {
+            f->cbufmax = f->cbufsz;
+            f->interactive = true;
+            f->flush_interval = io61_pipe_flush_interval;
+        }
+#ifdef F_GETPIPE_SZ
+        if (S_ISFIFO(s.st_mode) && f->mode == O_RDONLY) {
+            int cap = fcntl(f->fd, F_GETPIPE_SZ);
+            f->cbufmax = std::max(f->cbufsz, (off_t) std::max(cap, 0));
+        }
+#endif
+    }
+    f->cbufmin = f->cbufsz;
+}
+
+
+// io61_direct_open(f)
+//    Open a second, `O_DIRECT` descriptor for regular file `f` and switch
+//    to large aligned slots. Returns false if direct I/O is unavailable,
+//    as it is everywhere but Linux.
+
+static bool io61_direct_open(io61_file* f) {
+#if __linux__ && defined(O_DIRECT)
+    struct stat s;
+    if (!f->seekable || fstat(f->fd, &s) == -1 || !S_ISREG(s.st_mode)) {
+        return false;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", f->fd);
+    f->dfd = open(path, f->mode | O_DIRECT);
+    if (f->dfd == -1) {
+        return false;
+    }
+    f->cbufsz = std::max(f->cbufsz, io61_dio_slot_size);
+    f->cbufsz += -f->cbufsz & (io61_dio_align - 1);
+    f->cbufmin = f->cbufmax = f->cbufsz;
+    return true;
+#else
+    (void) f;
+    return false;
+#endif
+}
+
+
+// io61_map(f)
+//    Try to map the whole of `f` into memory. On success, the mapping
+//    becomes `f`’s cache, so reads and seeks within the file need no
+//    system calls. Files that cannot be mapped (pipes, sockets, devices,
+//    empty files) keep using the buffered `read` path.
+
+static void io61_map(io61_file* f) {
+    struct stat s;
+    if (fstat(f->fd, &s) == -1 || !S_ISREG(s.st_mode) || s.st_size <= 0) {
+        return;
+    }
+    void* m = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, f->fd, 0);
+    if (m == MAP_FAILED) {
+        return;
+    }
+    f->map = reinterpret_cast<unsigned char*>(m);
+    f->map_size = s.st_size;
+    if (f->pos_tag <= f->map_size) {
+        f->cbuf = f->map;
+        f->tag = f->start_tag = 0;
+        f->end_tag = f->map_size;
+    }
+}
+
+
 // io61_close(f)
 //    Closes the io61_file `f` and releases all its resources.
 
+static void io61_ra_stop(io61_file* f);
+static void io61_free(unsigned char* buf);
+
 int io61_close(io61_file* f) {
-    io61_flush(f);
+    while (io61_flush(f) == -1 && errno == EAGAIN) {
+        // Non-blocking files finish writing before closing.
+        io61_wait(f, POLLOUT, -1);
+    }
+    if (f->ra) {
+        io61_ra_stop(f);
+    }
+    for (auto& s : f->slots) {
+        io61_free(s.buf);
+    }
+    if (f->map) {
+        munmap(f->map, f->map_size);
+    }
+    if (f->dfd >= 0) {
+        close(f->dfd);
+    }
+    if (f->saved_flags != -1) {
+        fcntl(f->fd, F_SETFL, f->saved_flags);
+    }
+    io61_record_stats(f->fd, f->stats);
     int r = close(f->fd);
     delete f;
     return r;
@@ -46,18 +355,21 @@ int io61_close(io61_file* f) {
 //    Reads a single (unsigned) byte from `f` and returns it. Returns EOF,
 //    which equals -1, on end of file or error.
 
+static int io61_fill(io61_file* f);
+
 int io61_readc(io61_file* f) {
-    unsigned char ch;
-    ssize_t nr = read(f->fd, &ch, 1);
-    if (nr == 1) {
-        return ch;
-    } else if (nr == 0) {
-        errno = 0; // clear `errno` to indicate EOF
-        return -1;
-    } else {
-        assert(nr == -1 && errno > 0);
-        return -1;
+    if (f->pos_tag == f->end_tag) {
+        int r = io61_fill(f);
+        if (f->pos_tag == f->end_tag) {
+            if (r == 0) {
+                errno = 0; // clear `errno` to indicate EOF
+            }
+            return -1;
+        }
     }
+    unsigned char ch = f->cbuf[f->pos_tag - f->tag];
+    ++f->pos_tag;
+    return ch;
 }
 
 
@@ -74,18 +386,154 @@ int io61_readc(io61_file* f) {
 ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
     size_t nread = 0;
     while (nread != sz) {
-        int ch = io61_readc(f);
-        if (ch == EOF) {
+        if (f->pos_tag == f->end_tag) {
+            int r = io61_fill(f);
+            if (r == -1 && nread == 0) {
+                return -1;
+            } else if (f->pos_tag == f->end_tag) {
+                break;
+            }
+        }
+        size_t nleft = f->end_tag - f->pos_tag;
+        size_t ncopy = std::min(sz - nread, nleft);
+        memcpy(&buf[nread], &f->cbuf[f->pos_tag - f->tag], ncopy);
+        nread += ncopy;
+        f->pos_tag += ncopy;
+    }
+    return nread;
+}
+
+
+// io61_readv(f, iov, iovcnt)
+//    Reads into the `iovcnt` buffers described by `iov`, in order.
+//    Returns the total number of characters read, 0 at end of file, or -1
+//    if an error is encountered before any characters are read.
+//
+//    Cached data is copied out first. If at least a cache block’s worth
+//    remains, it is read with one `readv`, bypassing the cache.
+
+static void io61_iov_advance(std::vector<iovec>& v, size_t& i, size_t n);
+static ssize_t io61_sysreadv(io61_file* f, const iovec* iov, int iovcnt,
+                             off_t off);
+static void io61_skip(io61_file* f, size_t n);
+
+ssize_t io61_readv(io61_file* f, const iovec* iov, int iovcnt) {
+    std::vector<iovec> v(iov, iov + iovcnt);
+    size_t sz = 0;
+    for (auto& x : v) {
+        sz += x.iov_len;
+    }
+    size_t nread = 0, i = 0;
+    while (i != v.size() && f->pos_tag != f->end_tag) {
+        size_t n = std::min(v[i].iov_len, size_t(f->end_tag - f->pos_tag));
+        memcpy(v[i].iov_base, &f->cbuf[f->pos_tag - f->tag], n);
+        f->pos_tag += n;
+        nread += n;
+        io61_iov_advance(v, i, n);
+    }
+
+    if (sz - nread >= (size_t) f->cbufsz && f->cbuf != f->map && !f->ra) {
+        int n = std::min(int(v.size() - i), IOV_MAX);
+        ssize_t nr = io61_sysreadv(f, &v[i], n, f->pos_tag);
+        if (nr == -1) {
+            return nread != 0 ? nread : -1;
+        }
+        io61_skip(f, nr);
+        return nread + nr;
+    }
+
+    for (; i != v.size(); ++i) {
+        ssize_t nr = io61_read(f, (unsigned char*) v[i].iov_base,
+                               v[i].iov_len);
+        if (nr == -1) {
+            return nread != 0 ? nread : -1;
+        }
+        nread += nr;
+        if (nr != (ssize_t) v[i].iov_len) {
             break;
         }
-        buf[nread] = ch;
-        ++nread;
     }
-    if (nread != 0 || sz == 0 || errno == 0) {
-        return nread;
-    } else {
-        return -1;
+    return nread;
+}
+
+
+// io61_find_delim(f, delim, sz, data)
+//    Returns a view of the next characters in `f`, up to and including
+//    the first `delim`, and consumes them. At most `sz` characters are
+//    returned. Sets `*data` to the characters, which stay valid until
+//    the next call on `f`. Returns 0 at end of file and -1 on error.
+//
+//    The view never crosses a cache boundary, so it can end early
+//    without a `delim`. io61_readline copies whole lines.
+
+static const unsigned char* io61_memchr(const unsigned char* s, int c,
+                                        size_t n);
+
+ssize_t io61_find_delim(io61_file* f, int delim, size_t sz,
+                        const unsigned char** data) {
+    if (f->pos_tag == f->end_tag) {
+        int r = io61_fill(f);
+        if (f->pos_tag == f->end_tag) {
+            return r;
+        }
+    }
+    const unsigned char* p = &f->cbuf[f->pos_tag - f->tag];
+    size_t n = std::min(sz, size_t(f->end_tag - f->pos_tag));
+    if (const unsigned char* d = io61_memchr(p, delim, n)) {
+        n = d + 1 - p;
+    }
+    *data = p;
+    f->pos_tag += n;
+    return n;
+}
+
+
+// io61_readline(f, buf, sz)
+//    Reads characters from `f` into `buf` up to and including the next
+//    newline, stopping early at end of file or after `sz` characters.
+//    Returns the number of characters read, 0 at end of file, or -1 if an
+//    error is encountered before any characters are read.
+
+ssize_t io61_readline(io61_file* f, unsigned char* buf, size_t sz) {
+    size_t nread = 0;
+    while (nread != sz) {
+        const unsigned char* data;
+        ssize_t n = io61_find_delim(f, '\n', sz - nread, &data);
+        if (n == -1 && nread == 0) {
+            return -1;
+        } else if (n <= 0) {
+            break;
+        }
+        memcpy(&buf[nread], data, n);
+        nread += n;
+        if (buf[nread - 1] == '\n') {
+            break;
+        }
     }
+    return nread;
+}
+
+
+// io61_peek(f, data, sz), io61_consume(f, n)
+//    io61_peek sets `*data` and `*sz` to the characters available at the
+//    current position of read-only file `f` without consuming them. The
+//    data points into the cache and stays valid until the next call on
+//    `f`. Sets `*sz` to 0 at end of file. Returns 0 on success and -1 on
+//    error. io61_consume then consumes `n <= *sz` of those characters.
+
+int io61_peek(io61_file* f, const unsigned char** data, size_t* sz) {
+    int r = 0;
+    if (f->pos_tag == f->end_tag) {
+        r = io61_fill(f);
+    }
+    *data = f->cbuf + (f->pos_tag - f->tag);
+    *sz = f->end_tag - f->pos_tag;
+    return *sz != 0 ? 0 : r;
+}
+
+void io61_consume(io61_file* f, size_t n) {
+    assert(n <= size_t(f->end_tag - f->pos_tag));
+    f->pos_tag += n;
 }
 
 
@@ -93,14 +541,23 @@ ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
 //    Write a single character `c` to `f` (converted to unsigned char).
 //    Returns 0 on success and -1 on error.
 
+static int io61_wprepare(io61_file* f, size_t sz);
+static int io61_newline_flush(io61_file* f);
+
 int io61_writec(io61_file* f, int c) {
-    unsigned char ch = c;
-    ssize_t nw = write(f->fd, &ch, 1);
-    if (nw == 1) {
-        return 0;
-    } else {
-        return -1;
+    if (f->pos_tag != f->end_tag || f->end_tag == f->tag + f->cbufsz) {
+        if (io61_wprepare(f, 1) == -1) {
+            return -1;
+        }
+    }
+    f->cbuf[f->pos_tag - f->tag] = c;
+    ++f->pos_tag;
+    f->end_tag = std::max(f->end_tag, f->pos_tag);
+    f->dirty = true;
+    if (f->interactive && c == '\n') {
+        io61_newline_flush(f);
     }
+    return 0;
 }
 
 
@@ -110,15 +567,87 @@ int io61_writec(io61_file* f, int c) {
 //    a drive running out of space. In this case io61_write returns the
 //    number of characters written, or -1 if no characters were written
 //    before the error occurred.
+//
+//    Writes of at least a full cache block bypass the cache: any cached
+//    data is flushed first, then `buf` is written directly.
+
+static ssize_t io61_write_direct(io61_file* f, const unsigned char* buf,
+                                 size_t sz);
 
 ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
+    if (sz >= (size_t) f->cbufsz) {
+        if (io61_flush(f) == -1) {
+            return -1;
+        }
+        return io61_write_direct(f, buf, sz);
+    }
     size_t nwritten = 0;
     while (nwritten != sz) {
-        if (io61_writec(f, buf[nwritten]) == -1) {
-            break;
+        if (f->pos_tag != f->end_tag || f->end_tag == f->tag + f->cbufsz) {
+            int r = io61_wprepare(f, sz - nwritten);
+            if (r == -1 && nwritten == 0) {
+                return -1;
+            } else if (r == -1) {
+                break;
+            }
         }
-        ++nwritten;
+        size_t nleft = f->tag + f->cbufsz - f->pos_tag;
+        size_t ncopy = std::min(sz - nwritten, nleft);
+        memcpy(&f->cbuf[f->pos_tag - f->tag], &buf[nwritten], ncopy);
+        f->pos_tag += ncopy;
+        f->end_tag = std::max(f->end_tag, f->pos_tag);
+        f->dirty = true;
+        nwritten += ncopy;
+    }
+    if (f->interactive && memchr(buf, '\n', nwritten)) {
+        io61_newline_flush(f);
+    }
+    return nwritten;
+}
+
+
+// io61_writev(f, iov, iovcnt)
+//    Writes the `iovcnt` buffers described by `iov` to `f`, in order.
+//    Returns the total number of characters written, or -1 if an error
+//    occurred before any characters were written.
+//
+//    Like io61_write, small writes go to the cache. Writes of at least a
+//    cache block leave with one `writev` after flushing the cache.
+
+static ssize_t io61_syswritev(io61_file* f, const iovec* iov, int iovcnt,
+                              off_t off);
+
+ssize_t io61_writev(io61_file* f, const iovec* iov, int iovcnt) {
+    size_t sz = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        sz += iov[i].iov_len;
     }
+    size_t nwritten = 0;
+
+    if (sz < (size_t) f->cbufsz) {
+        for (int i = 0; i != iovcnt; ++i) {
+            ssize_t nw = io61_write(f, (const unsigned char*) iov[i].iov_base,
+                                    iov[i].iov_len);
+            if (nw == -1) {
+                break;
+            }
+            nwritten += nw;
+        }
+    } else if (io61_flush(f) == 0) {
+        std::vector<iovec> v(iov, iov + iovcnt);
+        size_t i = 0;
+        while (nwritten != sz) {
+            int n = std::min(int(v.size() - i), IOV_MAX);
+            ssize_t nw = io61_syswritev(f, &v[i], n, f->pos_tag);
+            if (nw <= 0) {
+                break;
+            }
+            nwritten += nw;
+            f->pos_tag += nw;
+            io61_iov_advance(v, i, nw);
+        }
+    }
+
     if (nwritten != 0 || sz == 0) {
         return nwritten;
     } else {
@@ -127,6 +656,378 @@ ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
 }
 
 
+// io61_reserve(f, data, sz), io61_commit(f, n)
+//    io61_reserve sets `*data` to space for up to `sz` characters at the
+//    current position of write-only file `f` and returns how many fit,
+//    which may be fewer than `sz`. The space is in the cache, so the
+//    caller can fill it in place. Returns -1 on error. io61_commit then
+//    writes the first `n` reserved characters to `f`, returning 0.
+
+ssize_t io61_reserve(io61_file* f, unsigned char** data, size_t sz) {
+    if (f->pos_tag != f->end_tag || f->end_tag == f->tag + f->cbufsz) {
+        // Leave the position inside or at the end of the dirty run, so
+        // committing any prefix of the reservation leaves no hole.
+        if (io61_wprepare(f, 0) == -1) {
+            return -1;
+        }
+    }
+    *data = &f->cbuf[f->pos_tag - f->tag];
+    return std::min(sz, size_t(f->tag + f->cbufsz - f->pos_tag));
+}
+
+int io61_commit(io61_file* f, size_t n) {
+    assert(f->pos_tag + (off_t) n <= f->tag + f->cbufsz);
+    if (n != 0) {
+        bool newline = f->interactive
+            && memchr(&f->cbuf[f->pos_tag - f->tag], '\n', n);
+        f->pos_tag += n;
+        f->end_tag = std::max(f->end_tag, f->pos_tag);
+        f->dirty = true;
+        if (newline) {
+            io61_newline_flush(f);
+        }
+    }
+    return 0;
+}
+
+
+// io61_ready(f, events)
+//    Returns the subset of `events` (POLLIN, POLLOUT) that `f` can serve
+//    from its cache without a system call.
+
+int io61_ready(io61_file* f, int events) {
+    int ready = 0;
+    if ((events & POLLIN)
+        && f->mode == O_RDONLY
+        && f->pos_tag < f->end_tag) {
+        ready |= POLLIN;
+    }
+    if ((events & POLLOUT)
+        && f->mode != O_RDONLY
+        && f->cur >= 0
+        && f->pos_tag == f->end_tag
+        && f->end_tag < f->tag + f->cbufsz) {
+        ready |= POLLOUT;
+    }
+    return ready;
+}
+
+
+// io61_copy(in, out, sz)
+//    Copies up to `sz` characters from the current position of read-only
+//    file `in` to write-only file `out`. Returns the number of characters
+//    copied, 0 if `in` was at end of file, or -1 if an error occurred
+//    before any characters were copied.
+//
+//    After flushing both caches, the copy runs inside the kernel with
+//    `copy_file_range`, `splice` or `sendfile`, depending on the file
+//    types (Linux only). If the kernel refuses, or elsewhere, the rest
+//    goes through the caches.
+
+static ssize_t io61_kcopy(io61_file* in, io61_file* out, size_t sz,
+                          bool* eof);
+
+ssize_t io61_copy(io61_file* in, io61_file* out, size_t sz) {
+    assert(in->mode == O_RDONLY && out->mode != O_RDONLY);
+    size_t ncopied = 0;
+    // Cached input goes first; the file position of an unseekable
+    // input is past it.
+    if (in->cbuf != in->map && in->pos_tag != in->end_tag) {
+        size_t n = std::min(sz, size_t(in->end_tag - in->pos_tag));
+        ssize_t nw = io61_write(out, &in->cbuf[in->pos_tag - in->tag], n);
+        if (nw == -1) {
+            return -1;
+        }
+        in->pos_tag += nw;
+        ncopied += nw;
+    }
+
+    bool eof = false;
+    if (ncopied != sz && !in->ra
+        && io61_flush(in) == 0 && io61_flush(out) == 0) {
+        ssize_t n = io61_kcopy(in, out, sz - ncopied, &eof);
+        ncopied += n;
+        if (in->seekable) {
+            in->fd_tag += n;
+        }
+        io61_skip(in, n);
+        out->pos_tag += n;
+        if (out->seekable) {
+            out->fd_tag = out->pos_tag;
+        }
+        if (io61_switch(out, out->pos_tag) == -1) {
+            return ncopied ? ncopied : -1;
+        }
+    }
+
+    int r = 0;
+    while (ncopied != sz && !eof) {
+        const unsigned char* data;
+        size_t n;
+        r = io61_peek(in, &data, &n);
+        if (r == -1 || n == 0) {
+            break;
+        }
+        n = std::min(n, sz - ncopied);
+        ssize_t nw = io61_write(out, data, n);
+        if (nw == -1) {
+            r = -1;
+            break;
+        }
+        io61_consume(in, nw);
+        ncopied += nw;
+    }
+    return ncopied == 0 && r == -1 ? -1 : ncopied;
+}
+
+
+// io61_scatter_gather(infs, outfs, block_size, lines, nthreads)
+//    Copies blocks from the `infs` to the `outfs` with `nthreads` worker
+//    threads, producing the same output as scattergather61's one-thread
+//    loop. Blocks are read from the inputs in turn, skipping inputs that
+//    reached end of file, and written to the outputs in turn. With
+//    `lines`, blocks are lines of up to `block_size` characters (see
+//    io61_readline). Returns 0 on success, or -1 with `errno` set if a write
+//    failed.
+//
+//    Each input is read ahead in chunks of many blocks, and each output
+//    has a queue of blocks to write, so a slow file only holds up the
+//    files that must wait for its blocks. A sequencer deals blocks from
+//    the inputs' chunks to the output queues in round-robin order. Each
+//    file is used by at most one worker at a time, so the io61 files
+//    need not be thread-safe. Like the one-thread loop, io61_scatter_gather
+//    closes each input once it reaches end of file (inputs left open by a
+//    failed write are closed before it returns); the caller closes the
+//    outputs.
+
+struct io61_sg_chunk {
+    std::vector<unsigned char> data;
+    std::vector<size_t> lens;       // block lengths (`lines` only)
+    size_t next = 0;                // index of next block to deal
+    size_t off = 0;                 // offset of next block to deal
+};
+
+struct io61_sg_piece {
+    std::shared_ptr<io61_sg_chunk> c;
+    size_t off;
+    size_t len;
+};
+
+struct io61_sg_input {
+    io61_file* f;
+    std::deque<std::shared_ptr<io61_sg_chunk>> chunks;  // read, not dealt
+    bool busy = false;              // is a worker reading `f`?
+    bool eof = false;               // has `f` reached end of file?
+};
+
+struct io61_sg_output {
+    io61_file* f;
+    std::deque<io61_sg_piece> pieces;  // dealt, not yet written
+    size_t nbytes = 0;              // bytes dealt and not yet written
+    bool busy = false;              // is a worker writing `f`?
+};
+
+struct io61_sg_state {
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<io61_sg_input> ins;
+    std::vector<io61_sg_output> outs;
+    std::vector<size_t> active;     // inputs not yet at end of file
+    size_t ini = 0;                 // position in `active` of next input
+    size_t outi = 0;                // next output
+    size_t block_size;
+    bool lines;
+    bool failed = false;
+    int err = 0;                    // `errno` of the first failed write
+};
+
+// Per-input read-ahead, in chunks, and per-output backlog limits
+static constexpr size_t io61_sg_chunk_size = 65536;
+static constexpr size_t io61_sg_max_chunks = 2;
+static constexpr size_t io61_sg_max_backlog = 1 << 20;
+
+// io61_sg_deal(st)
+//    Deal blocks to the output queues until the next input has no block
+//    ready or the next output's queue is full. Called with `st.m` locked.
+
+static void io61_sg_deal(io61_sg_state& st) {
+    while (!st.active.empty() && !st.failed) {
+        io61_sg_input& in = st.ins[st.active[st.ini]];
+        if (in.chunks.empty()) {
+            if (!in.eof) {
+                return;
+            }
+            st.active.erase(st.active.begin() + st.ini);
+            st.ini = st.active.empty() ? 0 : st.ini % st.active.size();
+            continue;
+        }
+        io61_sg_output& out = st.outs[st.outi];
+        if (out.nbytes >= io61_sg_max_backlog) {
+            return;
+        }
+        auto c = in.chunks.front();
+        size_t len = st.lines ? c->lens[c->next]
+            : std::min(st.block_size, c->data.size() - c->off);
+        if (!out.pieces.empty()
+            && out.pieces.back().c == c
+            && out.pieces.back().off + out.pieces.back().len == c->off) {
+            out.pieces.back().len += len;
+        } else {
+            out.pieces.push_back({c, c->off, len});
+        }
+        out.nbytes += len;
+        ++c->next;
+        c->off += len;
+        if (c->off == c->data.size()) {
+            in.chunks.pop_front();
+        }
+        st.outi = (st.outi + 1) % st.outs.size();
+        st.ini = (st.ini + 1) % st.active.size();
+    }
+}
+
+// io61_sg_read(st, f)
+//    Read a chunk of blocks from `f`. Sets `*eof` if `f` is exhausted.
+
+static std::shared_ptr<io61_sg_chunk> io61_sg_read(const io61_sg_state& st,
+                                                   io61_file* f, bool* eof) {
+    auto c = std::make_shared<io61_sg_chunk>();
+    size_t cap = std::max(st.block_size, io61_sg_chunk_size);
+    if (!st.lines) {
+        c->data.resize(cap - cap % st.block_size);
+        ssize_t nr = io61_read(f, c->data.data(), c->data.size());
+        c->data.resize(std::max(nr, ssize_t(0)));
+        *eof = c->data.empty() || nr < 0;
+        return c;
+    }
+    while (c->data.size() + st.block_size <= cap) {
+        size_t n = c->data.size();
+        c->data.resize(n + st.block_size);
+        ssize_t nr = io61_readline(f, &c->data[n], st.block_size);
+        c->data.resize(n + std::max(nr, ssize_t(0)));
+        if (nr <= 0) {
+            *eof = true;
+            break;
+        }
+        c->lens.push_back(nr);
+    }
+    return c;
+}
+
+// io61_sg_worker(st)
+//    Body of a worker thread. Writes queued blocks first, then reads
+//    ahead, preferring the input the sequencer is waiting for.
+
+static void io61_sg_worker(io61_sg_state& st) {
+    std::unique_lock<std::mutex> guard(st.m);
+    while (true) {
+        io61_sg_deal(st);
+
+        io61_sg_output* out = nullptr;
+        for (auto& o : st.outs) {
+            if (!o.busy && !o.pieces.empty()) {
+                out = &o;
+                break;
+            }
+        }
+        io61_sg_input* in = nullptr;
+        for (size_t i = 0; !out && !st.failed && i != st.active.size(); ++i) {
+            io61_sg_input& x = st.ins[st.active[(st.ini + i) % st.active.size()]];
+            if (!x.busy && !x.eof && x.chunks.size() < io61_sg_max_chunks) {
+                in = &x;
+                break;
+            }
+        }
+
+        if (out) {
+            std::deque<io61_sg_piece> pieces;
+            std::swap(pieces, out->pieces);
+            out->busy = true;
+            guard.unlock();
+            size_t nwritten = 0;
+            int err = 0;
+            for (auto& p : pieces) {
+                ssize_t nw = io61_write(out->f, &p.c->data[p.off], p.len);
+                if (nw != ssize_t(p.len) && err == 0) {
+                    err = errno ? errno : EIO;
+                }
+                nwritten += p.len;
+            }
+            pieces.clear();
+            guard.lock();
+            out->busy = false;
+            out->nbytes -= nwritten;
+            if (err != 0 && !st.failed) {
+                st.failed = true;
+                st.err = err;
+            }
+        } else if (in) {
+            in->busy = true;
+            guard.unlock();
+            bool eof = false;
+            auto c = io61_sg_read(st, in->f, &eof);
+            if (eof) {
+                io61_close(in->f);
+            }
+            guard.lock();
+            in->busy = false;
+            in->eof = eof;
+            if (!c->data.empty()) {
+                in->chunks.push_back(std::move(c));
+            }
+        } else if ((st.active.empty() || st.failed)
+                   && std::none_of(st.outs.begin(), st.outs.end(),
+                                   [&] (const io61_sg_output& o) {
+                                       return o.busy || (!o.pieces.empty()
+                                                         && !st.failed);
+                                   })) {
+            st.cv.notify_all();
+            return;
+        } else {
+            st.cv.wait(guard);
+            continue;
+        }
+        st.cv.notify_all();
+    }
+}
+
+int io61_scatter_gather(const std::vector<io61_file*>& infs,
+                        const std::vector<io61_file*>& outfs,
+                        size_t block_size, bool lines, size_t nthreads) {
+    assert(block_size > 0 && !outfs.empty() && nthreads > 0);
+    io61_sg_state st;
+    st.block_size = block_size;
+    st.lines = lines;
+    st.ins.resize(infs.size());
+    for (size_t i = 0; i != infs.size(); ++i) {
+        st.ins[i].f = infs[i];
+        st.active.push_back(i);
+    }
+    st.outs.resize(outfs.size());
+    for (size_t i = 0; i != outfs.size(); ++i) {
+        st.outs[i].f = outfs[i];
+    }
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < nthreads; ++i) {
+        workers.emplace_back(io61_sg_worker, std::ref(st));
+    }
+    io61_sg_worker(st);
+    for (auto& w : workers) {
+        w.join();
+    }
+    for (auto& in : st.ins) {
+        if (!in.eof) {
+            io61_close(in.f);
+        }
+    }
+    if (st.failed) {
+        errno = st.err;
+        return -1;
+    }
+    return 0;
+}
+
+
 // io61_flush(f)
 //    If `f` was opened write-only, `io61_flush(f)` forces a write of any
 //    cached data written to `f`. Returns 0 on success; returns -1 if an error
@@ -135,24 +1036,892 @@ ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
 //    If `f` was opened read-only, `io61_flush(f)` returns 0. It may also
 //    drop any data cached for reading.
 
+static void io61_save(io61_file* f);
+static void io61_attach(io61_file* f, int i);
+static int io61_flush_slot(io61_file* f, io61_slot& s);
+static int io61_flush_clean(io61_file* f);
+
 int io61_flush(io61_file* f) {
-    (void) f;
-    return 0;
+    if (f->mode == O_RDONLY) {
+        return io61_flush_clean(f);
+    }
+    io61_save(f);
+    int r = 0;
+    for (auto& s : f->slots) {
+        if (s.dirty && io61_flush_slot(f, s) == -1) {
+            r = -1;
+        }
+    }
+    if (f->cur >= 0) {
+        io61_attach(f, f->cur);
+    }
+    if (r == 0 && f->seekable && f->fd_tag != f->pos_tag) {
+        // Leave the file position where a stream of writes would have.
+        ++f->stats.seeks;
+        if (lseek(f->fd, f->pos_tag, SEEK_SET) == -1) {
+            return -1;
+        }
+        f->fd_tag = f->pos_tag;
+    }
+    return r;
+}
+
+
+// io61_newline_flush(f)
+//    Called when a newline was written to interactive file `f`. Flushes
+//    `f` unless its previous newline flush was less than
+//    `f->flush_interval` ago.
+
+static int io61_newline_flush(io61_file* f) {
+    if (f->flush_interval != 0) {
+        // The coarse clock is much cheaper to read, and its resolution
+        // (a clock tick) is fine for this purpose.
+        timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+        int64_t now = ts.tv_sec * int64_t(1000000000) + ts.tv_nsec;
+        if (now - f->last_flush < f->flush_interval) {
+            return 0;
+        }
+        f->last_flush = now;
+    }
+    return io61_flush(f);
 }
 
 
 // io61_seek(f, off)
 //    Changes the file pointer for file `f` to `off` bytes into the file.
 //    Returns 0 on success and -1 on failure.
+//
+//    Seeks within cached data need no system calls. Seeks also feed the
+//    access-pattern detector, which decides where the next cache window
+//    is placed (see `io61_place`).
+
+static void io61_observe_seek(io61_file* f, off_t off);
 
 int io61_seek(io61_file* f, off_t off) {
-    off_t r = lseek(f->fd, (off_t) off, SEEK_SET);
-    // Ignore the returned offset unless it’s an error.
-    if (r == -1) {
+    if (!f->seekable) {
+        errno = ESPIPE;
         return -1;
+    } else if (off < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    io61_observe_seek(f, off);
+    if (f->map && off <= f->map_size) {
+        // Mapped files seek within the mapping.
+        ++f->stats.cache_hits;
+        io61_detach(f);
+        f->cbuf = f->map;
+        f->tag = f->start_tag = 0;
+        f->end_tag = f->map_size;
+        f->pos_tag = off;
+        return 0;
+    }
+    if (f->cur >= 0
+        && off >= f->tag
+        && off < f->tag + f->cbufsz
+        && (f->mode != O_RDONLY || off <= f->end_tag)) {
+        // Seek within the loaded window.
+        ++f->stats.cache_hits;
+        f->pos_tag = off;
+        return 0;
+    }
+    f->pos_tag = off;
+    if (f->mode == O_RDONLY) {
+        // `io61_fill` will find or load the right slot.
+        io61_detach(f);
+        return 0;
+    } else {
+        return io61_switch(f, off);
+    }
+}
+
+
+// Helper functions
+
+// io61_fill(f)
+//    Fill the cache with data at `f->pos_tag` by reading from the file.
+//    Returns 0 on success (including end of file), -1 on error.
+
+static int io61_fill(io61_file* f) {
+    assert(f->pos_tag == f->end_tag);
+    return io61_switch(f, f->pos_tag);
+}
+
+
+// io61_wprepare(f, sz)
+//    Prepare the loaded window for a write of up to `sz` characters at
+//    `f->pos_tag`. Afterwards the window contains `f->pos_tag` and the write
+//    will extend the window’s dirty run contiguously, in either direction.
+//    Returns 0 on success, -1 if flushing cached data failed.
+
+static int io61_wprepare(io61_file* f, size_t sz) {
+    off_t off = f->pos_tag;
+    if (f->cur < 0 || off < f->tag || off >= f->tag + f->cbufsz) {
+        if (io61_switch(f, off) == -1) {
+            return -1;
+        }
+    }
+    if (f->start_tag == f->end_tag) {
+        f->start_tag = f->end_tag = off;
+    } else if (off > f->end_tag || off + (off_t) sz < f->start_tag) {
+        // The write would leave a hole: flush the dirty run first.
+        io61_save(f);
+        io61_slot& s = f->slots[f->cur];
+        if (io61_flush_slot(f, s) == -1) {
+            io61_attach(f, f->cur);
+            return -1;
+        }
+        s.start_tag = s.end_tag = off;
+        io61_attach(f, f->cur);
+    } else if (off < f->start_tag) {
+        f->start_tag = off;
+    }
+    return 0;
+}
+
+
+// io61_observe_seek(f, off)
+//    Classify the access pattern from the distance between consecutive
+//    seeks.
+
+static void io61_observe_seek(io61_file* f, off_t off) {
+    off_t delta = off - f->seek_tag;
+    if (delta < 0 && delta > -f->cbufsz) {
+        f->pattern = io61_reverse;
+    } else if (delta >= 0 && delta < f->cbufsz) {
+        f->pattern = io61_sequential;
+    } else if (delta == f->seek_delta) {
+        f->pattern = io61_strided;
     } else {
+        f->pattern = io61_random;
+    }
+    f->seek_tag = off;
+    f->seek_delta = delta;
+}
+
+
+// io61_save(f), io61_attach(f, i), io61_detach(f)
+//    Move the loaded window’s state into its slot, load slot `i` into the
+//    window, or save and unload the window. An unloaded window looks empty
+//    and full at once, so reads call `io61_fill` and writes call
+//    `io61_wprepare` before touching `f->cbuf`.
+
+static void io61_save(io61_file* f) {
+    if (f->cur >= 0) {
+        io61_slot& s = f->slots[f->cur];
+        s.start_tag = f->start_tag;
+        s.end_tag = f->end_tag;
+        s.dirty = f->dirty;
+    }
+}
+
+static void io61_attach(io61_file* f, int i) {
+    io61_slot& s = f->slots[i];
+    s.used = ++f->clock;
+    f->cur = f->last = i;
+    f->cbuf = s.buf;
+    f->tag = s.tag;
+    f->start_tag = s.start_tag;
+    f->end_tag = s.end_tag;
+    f->dirty = s.dirty;
+}
+
+static void io61_detach(io61_file* f) {
+    io61_save(f);
+    f->cur = -1;
+    f->cbuf = nullptr;
+    f->tag = f->pos_tag - f->cbufsz;
+    f->start_tag = f->end_tag = f->pos_tag;
+    f->dirty = false;
+}
+
+
+// io61_switch(f, off)
+//    Load a slot whose window contains `off`, choosing and placing a new
+//    one if necessary. For read-only files, also read file data at `off`
+//    into the slot. Returns 0 on success and -1 on error.
+//
+//    The slot search is a linear scan, which is cheap for the small slot
+//    counts `-C` is meant for. Lookups that need no I/O count as cache
+//    hits; the rest count as misses.
+
+static int io61_adapt(io61_file* f, off_t off);
+static int io61_victim(io61_file* f);
+static int io61_place(io61_file* f, int i, off_t off);
+static ssize_t io61_sysread(io61_file* f, unsigned char* buf, size_t sz,
+                            off_t off);
+static ssize_t io61_ra_take(io61_file* f, io61_slot& s);
+
+static int io61_switch(io61_file* f, off_t off) {
+    io61_detach(f);
+    int i = 0;
+    while (i != f->nslots
+           && (f->slots[i].tag == -1
+               || off < f->slots[i].tag
+               || off >= f->slots[i].tag + f->cbufsz)) {
+        ++i;
+    }
+    bool hit = i != f->nslots;
+    if (!hit) {
+        if (f->cbufmin != f->cbufmax && io61_adapt(f, off) == -1) {
+            return -1;
+        }
+        i = io61_victim(f);
+        if (io61_place(f, i, off) == -1) {
+            return -1;
+        }
+    }
+    io61_slot& s = f->slots[i];
+    if (f->mode == O_RDONLY && off >= s.end_tag) {
+        hit = false;
+        ssize_t nr;
+        if (f->ra && f->pattern == io61_sequential) {
+            // Read-ahead blocks replace whole slots.
+            if (s.tag != off && io61_place(f, i, off) == -1) {
+                return -1;
+            }
+            nr = io61_ra_take(f, s);
+        } else {
+            nr = io61_sysread(f, &s.buf[s.end_tag - s.tag],
+                              s.tag + f->cbufsz - s.end_tag, s.end_tag);
+        }
+        if (nr == -1) {
+            return -1;
+        }
+        s.end_tag += nr;
+    }
+    ++(hit ? f->stats.cache_hits : f->stats.cache_misses);
+    if (f->mode == O_RDONLY && off > s.end_tag) {
+        // Past end of file: stay unloaded.
+        return 0;
+    }
+    io61_attach(f, i);
+    return 0;
+}
+
+
+// io61_adapt(f, off)
+//    Called on a cache miss at `off`. Quadruples the slot size, up to
+//    `f->cbufmax`, when a sequential stream has just run off the end of
+//    its last full slot, so long streams need fewer system calls.
+//    Returns to the initial size when access turns strided or random,
+//    so scattered misses do not transfer unneeded data. Resizing flushes
+//    and empties every slot. Returns 0 on success, -1 on error.
+
+static int io61_adapt(io61_file* f, off_t off) {
+    io61_slot& last = f->slots[f->last];
+    off_t sz = f->cbufsz;
+    if (f->pattern == io61_sequential
+        && last.tag != -1
+        && off == last.tag + f->cbufsz) {
+        sz = std::min(4 * f->cbufsz, f->cbufmax);
+    } else if (f->pattern == io61_strided || f->pattern == io61_random) {
+        sz = f->cbufmin;
+    }
+    if (sz == f->cbufsz) {
+        return 0;
+    }
+    for (auto& s : f->slots) {
+        if (s.dirty && io61_flush_slot(f, s) == -1) {
+            return -1;
+        }
+        io61_free(s.buf);
+        s = io61_slot();
+    }
+    f->cbufsz = sz;
+    io61_detach(f);
+    return 0;
+}
+
+
+// io61_victim(f)
+//    Choose the slot to replace. Sequential and reverse streams reuse
+//    their last slot, so streaming does not wipe out the rest of the cache.
+//    Strided and random access replace the least recently used slot, so
+//    each stride lane, or each hot region, keeps its own block.
+
+static int io61_victim(io61_file* f) {
+    if (!f->seekable
+        || f->pattern == io61_sequential
+        || f->pattern == io61_reverse) {
+        return f->last;
+    }
+    int victim = 0;
+    for (int i = 1; i != f->nslots; ++i) {
+        if (f->slots[i].used < f->slots[victim].used) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+
+// io61_place(f, i, off)
+//    Empty slot `i` and position its window to serve an access at `off`.
+//    Reverse streams get end-aligned windows; everything else gets windows
+//    that start at `off`. Overlapping slots are flushed and dropped, so
+//    slot windows never overlap. Returns 0 on success, -1 on error.
+
+static unsigned char* io61_alloc(size_t sz);
+
+static int io61_place(io61_file* f, int i, off_t off) {
+    io61_slot& s = f->slots[i];
+    if (s.dirty && io61_flush_slot(f, s) == -1) {
+        return -1;
+    }
+    if (!s.buf) {
+        s.buf = io61_alloc(f->cbufsz);
+    }
+    off_t tag = off;
+    if (f->seekable && f->pattern == io61_reverse) {
+        off_t span = std::max(-f->seek_delta, (off_t) 1);
+        tag = std::max(off + span - f->cbufsz, (off_t) 0);
+    }
+    if (f->dfd >= 0) {
+        // Direct transfers need aligned windows.
+        tag -= tag % io61_dio_align;
+        if (off >= tag + f->cbufsz) {
+            tag += io61_dio_align;
+        }
+    }
+    for (auto& t : f->slots) {
+        if (&t != &s
+            && t.tag != -1
+            && t.tag < tag + f->cbufsz
+            && tag < t.tag + f->cbufsz) {
+            if (t.dirty && io61_flush_slot(f, t) == -1) {
+                return -1;
+            }
+            t.tag = t.start_tag = t.end_tag = -1;
+        }
+    }
+    s.tag = s.start_tag = s.end_tag = tag;
+    return 0;
+}
+
+
+// io61_flush_slot(f, s)
+//    Write slot `s`’s dirty run to the file. Returns 0 on success and -1
+//    on error; on error, the unwritten suffix stays cached.
+
+static ssize_t io61_syswrite(io61_file* f, const unsigned char* buf,
+                             size_t sz, off_t off);
+
+static int io61_flush_slot(io61_file* f, io61_slot& s) {
+    ++f->stats.flushes;
+    while (s.start_tag != s.end_tag) {
+        ssize_t nw = io61_syswrite(f, &s.buf[s.start_tag - s.tag],
+                                   s.end_tag - s.start_tag, s.start_tag);
+        if (nw == -1) {
+            return -1;
+        }
+        s.start_tag += nw;
+    }
+    s.dirty = false;
+    return 0;
+}
+
+
+// io61_flush_clean(f)
+//    Called by io61_flush for read-only files. Moves the file position to
+//    the logical position `f->pos_tag`, so the file descriptor can be
+//    shared with other readers. Cached data stays valid.
+
+static int io61_flush_clean(io61_file* f) {
+    if (f->seekable && f->fd_tag != f->pos_tag) {
+        ++f->stats.seeks;
+        if (lseek(f->fd, f->pos_tag, SEEK_SET) == -1) {
+            return -1;
+        }
+        f->fd_tag = f->pos_tag;
+    }
+    return 0;
+}
+
+
+// io61_write_direct(f, buf, sz)
+//    Write `buf` at `f->pos_tag`, bypassing the cache, which must be clean.
+//    Returns the number of characters written, or -1 if an error occurred
+//    before any characters were written.
+
+static ssize_t io61_write_direct(io61_file* f, const unsigned char* buf,
+                                 size_t sz) {
+    size_t nwritten = 0;
+    while (nwritten != sz) {
+        ssize_t nw = io61_syswrite(f, &buf[nwritten], sz - nwritten,
+                                   f->pos_tag);
+        if (nw == -1) {
+            break;
+        }
+        nwritten += nw;
+        f->pos_tag += nw;
+    }
+    if (nwritten != 0 || sz == 0) {
+        return nwritten;
+    } else {
+        return -1;
+    }
+}
+
+
+// io61_count(ncalls, nbytes, r)
+//    Count a system call that returned `r` in a set of `io61_stats`
+//    counters: one more call, and `r` more bytes if it succeeded.
+
+static void io61_count(size_t& ncalls, size_t& nbytes, ssize_t r) {
+    ++ncalls;
+    if (r > 0) {
+        nbytes += r;
+    }
+}
+
+
+// io61_sysread(f, buf, sz, off), io61_syswrite(f, buf, sz, off)
+//    Transfer data at file offset `off` with a single system call, retrying
+//    as io61_retry says. Use `read`/`write` when the file position is
+//    already at `off` (or the file is not seekable), and `pread`/`pwrite`
+//    otherwise, so that seeks never cost an `lseek`.
+
+static bool io61_direct(io61_file* f, const unsigned char* buf, size_t& sz,
+                        off_t off);
+static bool io61_direct_fail(io61_file* f);
+static bool io61_retry(io61_file* f, short events);
+
+static ssize_t io61_sysread(io61_file* f, unsigned char* buf, size_t sz,
+                            off_t off) {
+    while (true) {
+        ssize_t nr;
+        size_t n = sz;
+        if (io61_direct(f, buf, n, off)) {
+            nr = pread(f->dfd, buf, n, off);
+        } else if (!f->seekable || off == f->fd_tag) {
+            nr = read(f->fd, buf, n);
+            if (nr > 0 && f->seekable) {
+                f->fd_tag += nr;
+            }
+        } else {
+            nr = pread(f->fd, buf, n, off);
+        }
+        io61_count(f->stats.reads, f->stats.bytes_read, nr);
+        if (nr == -1 && errno == EINVAL && io61_direct_fail(f)) {
+            continue;
+        } else if (nr >= 0 || !io61_retry(f, POLLIN)) {
+            return nr;
+        }
+    }
+}
+
+static ssize_t io61_syswrite(io61_file* f, const unsigned char* buf,
+                             size_t sz, off_t off) {
+    while (true) {
+        ssize_t nw;
+        size_t n = sz;
+        if (io61_direct(f, buf, n, off)) {
+            nw = pwrite(f->dfd, buf, n, off);
+        } else if (!f->seekable || off == f->fd_tag) {
+            nw = write(f->fd, buf, n);
+            if (nw > 0 && f->seekable) {
+                f->fd_tag += nw;
+            }
+        } else {
+            nw = pwrite(f->fd, buf, n, off);
+        }
+        io61_count(f->stats.writes, f->stats.bytes_written, nw);
+        if (nw == -1 && errno == EINVAL && io61_direct_fail(f)) {
+            continue;
+        } else if (nw >= 0 || !io61_retry(f, POLLOUT)) {
+            return nw;
+        }
+    }
+}
+
+
+// Read-ahead functions
+
+// io61_retry(f, events)
+//    Returns true if a system call on `f` that just failed should be
+//    retried. Interrupted calls are retried. So are calls that would
+//    block, after waiting for `events` with `poll`, unless `f` is in
+//    non-blocking mode.
+
+static bool io61_retry(io61_file* f, short events) {
+    if (errno == EINTR) {
+        return true;
+    } else if (errno != EAGAIN || f->nonblocking) {
+        return false;
+    }
+    pollfd p = {f->fd, events, 0};
+    poll(&p, 1, -1);
+    return true;
+}
+
+
+// io61_direct(f, buf, sz, off)
+//    Returns true if the transfer of `sz` characters between `buf` and
+//    file offset `off` should use `O_DIRECT`, first shrinking `sz` to
+//    its aligned part. Unaligned heads and tails go through the page
+//    cache: a transfer starting before an alignment boundary is cut
+//    short at that boundary.
+//
+// io61_direct_fail(f)
+//    Turns off direct I/O for `f` after the kernel rejected a direct
+//    transfer. Returns true if it was on.
+
+static bool io61_direct(io61_file* f, const unsigned char* buf, size_t& sz,
+                        off_t off) {
+    if (f->dfd < 0) {
+        return false;
+    }
+    off_t head = -off & (io61_dio_align - 1);
+    if (head != 0 && (size_t) head < sz) {
+        sz = head;
+    }
+    if (head != 0
+        || reinterpret_cast<uintptr_t>(buf) % io61_dio_align != 0
+        || sz < (size_t) io61_dio_align) {
+        return false;
+    }
+    sz -= sz % io61_dio_align;
+    return true;
+}
+
+static bool io61_direct_fail(io61_file* f) {
+    if (f->dfd < 0) {
+        return false;
+    }
+    close(f->dfd);
+    f->dfd = -1;
+    return true;
+}
+
+
+// io61_skip(f, n)
+//    Advances read-only file `f` past `n` characters that were read from
+//    its file descriptor without going through the cache.
+
+static void io61_skip(io61_file* f, size_t n) {
+    f->pos_tag += n;
+    if (f->cbuf != f->map || f->pos_tag > f->end_tag) {
+        io61_detach(f);
+    }
+    if (n != 0 && !f->seekable) {
+        // Slots can no longer be extended from the file position.
+        for (auto& s : f->slots) {
+            s.tag = -1;
+        }
+    }
+}
+
+
+// io61_sysreadv(f, iov, iovcnt, off), io61_syswritev(f, iov, iovcnt, off)
+//    Vectored versions of io61_sysread and io61_syswrite.
+
+static ssize_t io61_sysreadv(io61_file* f, const iovec* iov, int iovcnt,
+                             off_t off) {
+    while (true) {
+        ssize_t nr;
+        if (!f->seekable || off == f->fd_tag) {
+            nr = readv(f->fd, iov, iovcnt);
+            if (nr > 0 && f->seekable) {
+                f->fd_tag += nr;
+            }
+        } else {
+            nr = preadv(f->fd, iov, iovcnt, off);
+        }
+        io61_count(f->stats.reads, f->stats.bytes_read, nr);
+        if (nr >= 0 || !io61_retry(f, POLLIN)) {
+            return nr;
+        }
+    }
+}
+
+static ssize_t io61_syswritev(io61_file* f, const iovec* iov, int iovcnt,
+                              off_t off) {
+    while (true) {
+        ssize_t nw;
+        if (!f->seekable || off == f->fd_tag) {
+            nw = writev(f->fd, iov, iovcnt);
+            if (nw > 0 && f->seekable) {
+                f->fd_tag += nw;
+            }
+        } else {
+            nw = pwritev(f->fd, iov, iovcnt, off);
+        }
+        io61_count(f->stats.writes, f->stats.bytes_written, nw);
+        if (nw >= 0 || !io61_retry(f, POLLOUT)) {
+            return nw;
+        }
+    }
+}
+
+
+// io61_iov_advance(v, i, n)
+//    Drops the first `n` characters from the buffers `v[i...]`, advancing
+//    `i` past buffers that become empty.
+
+static void io61_iov_advance(std::vector<iovec>& v, size_t& i, size_t n) {
+    while (i != v.size() && n >= v[i].iov_len) {
+        n -= v[i].iov_len;
+        ++i;
+    }
+    if (n != 0) {
+        v[i].iov_base = (char*) v[i].iov_base + n;
+        v[i].iov_len -= n;
+    }
+}
+
+
+// io61_kcopy(in, out, sz, eof)
+//    Copies up to `sz` characters from `in`’s file position to `out`’s
+//    inside the kernel. Sets `*eof` if `in` reached end of file. Returns
+//    the number of characters copied; stops early, without reporting an
+//    error, if the kernel cannot copy between these files.
+
+static ssize_t io61_kcopy(io61_file* in, io61_file* out, size_t sz,
+                          bool* eof) {
+#if __linux__
+    struct stat ist, ost;
+    if (fstat(in->fd, &ist) == -1 || fstat(out->fd, &ost) == -1) {
         return 0;
     }
+    size_t ncopied = 0;
+    while (ncopied != sz) {
+        size_t n = std::min(sz - ncopied, size_t(1) << 30);
+        ssize_t r;
+        if (S_ISFIFO(ist.st_mode) || S_ISFIFO(ost.st_mode)) {
+            r = splice(in->fd, nullptr, out->fd, nullptr, n, SPLICE_F_MOVE);
+        } else if (S_ISREG(ist.st_mode) && S_ISREG(ost.st_mode)) {
+            r = copy_file_range(in->fd, nullptr, out->fd, nullptr, n, 0);
+        } else {
+            r = sendfile(out->fd, in->fd, nullptr, n);
+        }
+        // A kernel copy counts as a read of `in` and a write of `out`.
+        io61_count(in->stats.reads, in->stats.bytes_read, r);
+        io61_count(out->stats.writes, out->stats.bytes_written, r);
+        if (r == 0) {
+            *eof = true;
+            break;
+        } else if (r == -1 && errno != EINTR) {
+            break;
+        } else if (r > 0) {
+            ncopied += r;
+        }
+    }
+    return ncopied;
+#else
+    (void) in, (void) out, (void) sz, (void) eof;
+    return 0;
+#endif
+}
+
+
+// io61_alloc(sz), io61_free(buf)
+//    Allocate and free slot and read-ahead buffers, aligned for direct
+//    I/O.
+
+static unsigned char* io61_alloc(size_t sz) {
+    void* buf;
+    if (posix_memalign(&buf, io61_dio_align, sz) != 0) {
+        throw std::bad_alloc();
+    }
+    return reinterpret_cast<unsigned char*>(buf);
+}
+
+static void io61_free(unsigned char* buf) {
+    free(buf);
+}
+
+
+// io61_ra_start(f, nblocks)
+//    Start a read-ahead thread for `f` that keeps up to `nblocks` blocks
+//    ahead of the application.
+
+static void io61_ra_thread(io61_file* f);
+
+static void io61_ra_start(io61_file* f, size_t nblocks) {
+    io61_readahead* ra = new io61_readahead;
+    for (size_t i = 0; i != nblocks; ++i) {
+        ra->free.push_back(io61_alloc(f->cbufsz));
+    }
+    ra->next_tag = f->pos_tag;
+    f->ra = ra;
+    ra->thread = std::thread(io61_ra_thread, f);
+}
+
+
+// io61_ra_thread(f)
+//    Body of the read-ahead thread. Fills free buffers with consecutive
+//    blocks until end of file, an error, or a stop request. Blocks read
+//    before the stream was repositioned are recycled unseen.
+
+static void io61_ra_thread(io61_file* f) {
+    io61_readahead* ra = f->ra;
+    std::unique_lock<std::mutex> guard(ra->m);
+    while (!ra->stop) {
+        if (ra->free.empty() || ra->eof) {
+            ra->cv.wait(guard);
+            continue;
+        }
+        unsigned char* buf = ra->free.back();
+        ra->free.pop_back();
+        off_t tag = ra->next_tag;
+        unsigned gen = ra->gen;
+        guard.unlock();
+
+        ssize_t nr;
+        while (true) {
+            if (f->seekable) {
+                nr = pread(f->fd, buf, f->cbufsz, tag);
+            } else {
+                nr = read(f->fd, buf, f->cbufsz);
+            }
+            if (nr >= 0 || !io61_retry(f, POLLIN)) {
+                break;
+            }
+        }
+        int err = nr < 0 ? errno : 0;
+
+        guard.lock();
+        io61_count(ra->stats.reads, ra->stats.bytes_read, nr);
+        if (gen != ra->gen) {
+            ra->free.push_back(buf);
+            continue;
+        }
+        if (nr > 0) {
+            ra->ready.push_back({buf, tag, nr});
+            ra->next_tag += nr;
+        } else {
+            ra->free.push_back(buf);
+            ra->eof = true;
+            ra->err = err;
+        }
+        ra->cv.notify_all();
+    }
+}
+
+
+// io61_ra_take(f, s)
+//    Load the read-ahead block at offset `s.tag` into slot `s`, which must
+//    be empty, by swapping buffers with the block. The caller extends
+//    `s.end_tag`. Waits for the thread if
+//    the block is not ready yet, and repositions the stream if the
+//    application moved elsewhere. Returns the number of bytes loaded,
+//    0 at end of file, or -1 on error.
+
+static ssize_t io61_ra_take(io61_file* f, io61_slot& s) {
+    io61_readahead* ra = f->ra;
+    assert(s.end_tag == s.tag);
+    std::unique_lock<std::mutex> guard(ra->m);
+    off_t expected = ra->ready.empty() ? ra->next_tag : ra->ready.front().tag;
+    if (expected != s.tag && f->seekable) {
+        for (auto& b : ra->ready) {
+            ra->free.push_back(b.buf);
+        }
+        ra->ready.clear();
+        ++ra->gen;
+        ra->next_tag = s.tag;
+        ra->eof = false;
+        ra->err = 0;
+        ra->cv.notify_all();
+    }
+    while (ra->ready.empty() && !ra->eof) {
+        ra->cv.wait(guard);
+    }
+    if (ra->ready.empty()) {
+        if (ra->err) {
+            errno = ra->err;
+            return -1;
+        }
+        return 0;
+    }
+    io61_rablock b = ra->ready.front();
+    ra->ready.pop_front();
+    assert(b.tag == s.tag);
+    ra->free.push_back(s.buf);
+    s.buf = b.buf;
+    ra->cv.notify_all();
+    return b.len;
+}
+
+
+// io61_ra_stop(f)
+//    Stop `f`’s read-ahead thread and free its buffers.
+
+static void io61_ra_stop(io61_file* f) {
+    io61_readahead* ra = f->ra;
+    {
+        std::unique_lock<std::mutex> guard(ra->m);
+        ra->stop = true;
+        ra->cv.notify_all();
+    }
+    ra->thread.join();
+    f->stats += ra->stats;
+    for (auto& b : ra->ready) {
+        io61_free(b.buf);
+    }
+    for (auto buf : ra->free) {
+        io61_free(buf);
+    }
+    delete ra;
+    f->ra = nullptr;
+}
+
+
+// io61_memchr(s, c, n)
+//    Like memchr: returns a pointer to the first `c` in `s[0, n)`, or
+//    nullptr. Scans 32 bytes at a time with AVX2 when the CPU has it,
+//    16 with SSE2 otherwise, and one at a time off x86-64.
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static size_t io61_memchr_avx2(const unsigned char* s, int c, size_t n) {
+    __m256i needle = _mm256_set1_epi8((char) c);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) &s[i]);
+        unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, needle));
+        if (m) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i;
+}
+
+static size_t io61_memchr_sse2(const unsigned char* s, int c, size_t n) {
+    __m128i needle = _mm_set1_epi8((char) c);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) &s[i]);
+        unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(x, needle));
+        if (m) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i;
+}
+#endif
+
+static const unsigned char* io61_memchr(const unsigned char* s, int c,
+                                        size_t n) {
+    size_t i = 0;
+#if defined(__x86_64__)
+    // The vector loops return the index of the match, or where they
+    // stopped; the scalar loop below finishes the tail.
+    static bool avx2 = __builtin_cpu_supports("avx2");
+    i = avx2 ? io61_memchr_avx2(s, c, n) : io61_memchr_sse2(s, c, n);
+#endif
+    c = (unsigned char) c;
+    for (; i != n; ++i) {
+        if (s[i] == c) {
+            return &s[i];
+        }
+    }
+    return nullptr;
 }
 
 
@@ -167,7 +1936,7 @@ int io61_seek(io61_file* f, off_t off) {
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
     if (filename) {
-        fd = open(filename, mode, 0666);
+        fd = open(filename, mode & ~(io61_o_direct | O_NONBLOCK), 0666);
     } else if ((mode & O_ACCMODE) == O_RDONLY) {
         fd = STDIN_FILENO;
     } else {
@@ -177,7 +1946,7 @@ io61_file* io61_open_check(const char* filename, int mode) {
         fprintf(stderr, "%s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    return io61_fdopen(fd, mode & (O_ACCMODE | io61_o_direct | O_NONBLOCK));
 }
 
 
@@ -9,6 +9,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sched.h>
+#include <sys/uio.h>
+#include <poll.h>
 
 struct io61_file;
 
@@ -27,12 +29,80 @@ int io61_writec(io61_file* f, int c);
 ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz);
 ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz);
 
+ssize_t io61_readv(io61_file* f, const iovec* iov, int iovcnt);
+ssize_t io61_writev(io61_file* f, const iovec* iov, int iovcnt);
+
+ssize_t io61_readline(io61_file* f, unsigned char* buf, size_t sz);
+ssize_t io61_find_delim(io61_file* f, int delim, size_t sz,
+                        const unsigned char** data);
+
+int io61_peek(io61_file* f, const unsigned char** data, size_t* sz);
+void io61_consume(io61_file* f, size_t n);
+ssize_t io61_reserve(io61_file* f, unsigned char** data, size_t sz);
+int io61_commit(io61_file* f, size_t n);
+
+ssize_t io61_copy(io61_file* in, io61_file* out, size_t sz);
+
+int io61_ready(io61_file* f, int events);
+int io61_wait(io61_file* f, int events, int timeout);
+
+struct io61_pollfd {
+    io61_file* f;       // file to wait for
+    short events;       // requested events (POLLIN, POLLOUT)
+    short revents;      // returned events
+};
+
+int io61_poll(io61_pollfd* fds, size_t nfds, int timeout);
+
+int io61_scatter_gather(const std::vector<io61_file*>& infs,
+                        const std::vector<io61_file*>& outfs,
+                        size_t block_size, bool lines, size_t nthreads);
+
 int io61_flush(io61_file* f);
 
 int fd_open_check(const char* filename, int mode);
 FILE* stdio_open_check(const char* filename, int mode);
 
 
+// io61_params
+//    Tuning parameters for files opened from now on. `io61_args::parse`
+//    sets them from the command line; implementations may ignore them.
+
+struct io61_params {
+    size_t cache_slots = 16;            // `-C`: cache slots per file
+    size_t cache_slot_size = 0;         // `-C`: bytes per slot (0: adaptive)
+    size_t readahead = 0;               // `-R`: blocks read ahead (0: off)
+    bool direct = false;                // `-U`: use O_DIRECT when possible
+};
+
+extern io61_params io61_defaults;
+
+
+// io61_stats
+//    Counters reported by the profiler, per file and summed over all
+//    files. Implementations that do not track a counter leave it at zero.
+
+struct io61_stats {
+    size_t reads = 0;           // read system calls (`read`, `pread`, ...)
+    size_t writes = 0;          // write system calls
+    size_t seeks = 0;           // `lseek` system calls
+    size_t bytes_read = 0;      // bytes moved by read system calls
+    size_t bytes_written = 0;   // bytes moved by write system calls
+    size_t cache_hits = 0;      // cache lookups served from memory
+    size_t cache_misses = 0;    // cache lookups that needed I/O
+    size_t flushes = 0;         // dirty cache buffers written back
+
+    io61_stats& operator+=(const io61_stats& x);
+};
+
+extern io61_stats io61_totals;
+
+// io61_record_stats(fd, stats)
+//    Report the counters for a file that used descriptor `fd` and is now
+//    closed. Adds them to `io61_totals` and to the profiler's per-file list.
+void io61_record_stats(int fd, const io61_stats& stats);
+
+
 struct io61_args {
     size_t file_size = SIZE_MAX;        // `-s`: file size
     size_t block_size = 0;              // `-b`: block size
@@ -53,6 +123,7 @@ struct io61_args {
     double delay = 0.0;                 // `-D`: delay
     size_t pipebuf_size = 0;            // `-B`: pipe buffer size
     bool nonblocking = false;           // `-n`: nonblocking
+    size_t threads = 0;                 // `-j`: worker threads
 
     explicit io61_args(const char* opts, size_t block_size = 0);
 
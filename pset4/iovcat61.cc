@@ -0,0 +1,52 @@
+#include "io61.hh"
+
+// Usage: ./iovcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to standard output in blocks, reading and
+//    writing each block as three fragments with io61_readv and
+//    io61_writev. Default BLOCKSIZE is 4096.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("b:o:i:D:Fy", 4096).parse(argc, argv);
+
+    // Allocate buffer, open files
+    unsigned char* buf = new unsigned char[args.block_size];
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    args.after_open(inf, O_RDONLY);
+    args.after_open(outf, O_WRONLY);
+
+    // Split the buffer into a short header, a body, and a short trailer
+    size_t edge = std::min(args.block_size / 4, size_t(64));
+    iovec iov[3] = {
+        {buf, edge},
+        {buf + edge, args.block_size - 2 * edge},
+        {buf + args.block_size - edge, edge}
+    };
+
+    // Copy file data
+    while (true) {
+        ssize_t nr = io61_readv(inf, iov, 3);
+        if (nr <= 0) {
+            break;
+        }
+
+        // Write back the fragments that were filled
+        iovec wiov[3];
+        int n = 0;
+        for (size_t left = nr; left != 0; ++n) {
+            wiov[n].iov_base = iov[n].iov_base;
+            wiov[n].iov_len = std::min(left, iov[n].iov_len);
+            left -= wiov[n].iov_len;
+        }
+        ssize_t nw = io61_writev(outf, wiov, n);
+        assert(nw == nr);
+
+        args.after_write(outf);
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    delete[] buf;
+}
@@ -0,0 +1,41 @@
+#include "io61.hh"
+
+// Usage: ./peekcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to standard output in blocks of at most
+//    BLOCKSIZE bytes, passing data directly from the input cache to the
+//    output cache with io61_peek and io61_reserve. Default BLOCKSIZE is
+//    4096.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("b:o:i:D:Fy", 4096).parse(argc, argv);
+
+    // Open files
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    args.after_open(inf, O_RDONLY);
+    args.after_open(outf, O_WRONLY);
+
+    // Copy file data
+    while (true) {
+        const unsigned char* data;
+        size_t nr;
+        if (io61_peek(inf, &data, &nr) == -1 || nr == 0) {
+            break;
+        }
+
+        unsigned char* out;
+        ssize_t nw = io61_reserve(outf, &out, std::min(nr, args.block_size));
+        assert(nw > 0);
+        memcpy(out, data, nw);
+        int r = io61_commit(outf, nw);
+        assert(r == 0);
+        io61_consume(inf, nw);
+
+        args.after_write(outf);
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+}
@@ -0,0 +1,91 @@
+#include "io61.hh"
+
+// Usage: ./pollcat61 [-b BLOCKSIZE] [-i INFILE]... [-o OUTFILE]...
+//    Copies each INFILE to the corresponding OUTFILE in blocks, driving
+//    all the copies from one thread. Files are opened in non-blocking
+//    mode, and the program waits for them with io61_poll. With no files,
+//    copies standard input to standard output. Default BLOCKSIZE is 4096.
+
+struct stream {
+    io61_file* inf;
+    io61_file* outf;
+    unsigned char* buf;
+    size_t pos = 0;         // next character in `buf` to write
+    size_t len = 0;         // number of characters in `buf`
+    bool eof = false;       // has `inf` reached end of file?
+};
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("b:i:o:D:##", 4096).parse(argc, argv);
+    if (args.input_files.size() != args.output_files.size()) {
+        args.usage();
+        exit(1);
+    }
+
+    // Allocate buffers, open files
+    std::vector<stream> streams(args.input_files.size());
+    for (size_t i = 0; i != streams.size(); ++i) {
+        streams[i].inf = io61_open_check(args.input_files[i],
+                                         O_RDONLY | O_NONBLOCK);
+        streams[i].outf = io61_open_check(args.output_files[i],
+                                          O_WRONLY | O_CREAT | O_TRUNC
+                                          | O_NONBLOCK);
+        streams[i].buf = new unsigned char[args.block_size];
+    }
+    args.after_open();
+
+    // Copy file data
+    std::vector<io61_pollfd> pfds;
+    std::vector<stream*> pstreams;
+    while (true) {
+        // Wait for input on streams with an empty buffer, and for output
+        // on the rest
+        pfds.clear();
+        pstreams.clear();
+        for (auto& s : streams) {
+            if (s.pos != s.len) {
+                pfds.push_back({s.outf, POLLOUT, 0});
+            } else if (!s.eof) {
+                pfds.push_back({s.inf, POLLIN, 0});
+            } else {
+                continue;
+            }
+            pstreams.push_back(&s);
+        }
+        if (pfds.empty()) {
+            break;
+        }
+        int r = io61_poll(pfds.data(), pfds.size(), -1);
+        assert(r > 0 || (r == -1 && errno == EINTR));
+
+        for (size_t i = 0; i != pfds.size(); ++i) {
+            stream* s = pstreams[i];
+            if (pfds[i].revents == 0) {
+                continue;
+            } else if (s->pos == s->len) {
+                ssize_t nr = io61_read(s->inf, s->buf, args.block_size);
+                if (nr > 0) {
+                    s->pos = 0;
+                    s->len = nr;
+                } else if (nr == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    s->eof = true;
+                }
+            } else {
+                ssize_t nw = io61_write(s->outf, s->buf + s->pos,
+                                        s->len - s->pos);
+                if (nw > 0) {
+                    s->pos += nw;
+                } else {
+                    assert(errno == EAGAIN || errno == EINTR);
+                }
+            }
+        }
+    }
+
+    for (auto& s : streams) {
+        io61_close(s.inf);
+        io61_close(s.outf);
+        delete[] s.buf;
+    }
+}
@@ -1,30 +1,19 @@
 #include "io61.hh"
 #include <vector>
 
-// Usage: ./scattergather61 [-b BLOCKSIZE] [-i IFILE | -o OFILE]...
+// Usage: ./scattergather61 [-b BLOCKSIZE] [-j N] [-i IFILE | -o OFILE]...
 //    Copies the input IFILEs to the output OFILEs, alternating
 //    with every block. (I.e., read from IFILE1 and write to OFILE1,
 //    then read from IFILE2 and write to OFILE2, etc. There may be
 //    different numbers of IFILEs and OFILEs.) This is a
 //    "scatter/gather" I/O pattern: input is "gathered" from many
 //    input files and "scattered" to many output files.
-//    Default BLOCKSIZE is 1.
+//    Default BLOCKSIZE is 1. With `-j N`, N threads copy the files
+//    concurrently (see io61_scatter_gather); the output is the same.
 
 ssize_t read_line(io61_file* f, unsigned char* buf, size_t sz, bool lines) {
     if (lines) {
-        size_t i = 0;
-        while (i != sz) {
-            int ch = io61_readc(f);
-            if (ch == EOF) {
-                break;
-            }
-            buf[i] = ch;
-            ++i;
-            if (ch == '\n') {
-                break;
-            }
-        }
-        return i;
+        return io61_readline(f, buf, sz);
     } else {
         return io61_read(f, buf, sz);
     }
@@ -33,7 +22,7 @@ ssize_t read_line(io61_file* f, unsigned char* buf, size_t sz, bool lines) {
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_args args = io61_args("b:i:o:l##", 1).parse(argc, argv);
+    io61_args args = io61_args("b:i:o:lj:##", 1).parse(argc, argv);
 
     // Allocate buffer, open files
     unsigned char* buf = new unsigned char[args.block_size];
@@ -49,6 +38,15 @@ int main(int argc, char* argv[]) {
     }
 
     // Copy file data
+    if (args.threads) {
+        int r = io61_scatter_gather(infs, outfs, args.block_size,
+                                    args.lines, args.threads);
+        if (r < 0) {
+            fprintf(stderr, "scattergather61: %s\n", strerror(errno));
+            exit(1);
+        }
+        infs.clear();           // io61_scatter_gather closed them
+    }
     size_t ini = -1, outi = 0;
     while (!infs.empty()) {
         ini = (ini + 1) % infs.size();
@@ -59,7 +57,10 @@ int main(int argc, char* argv[]) {
             --ini;
         } else {
             ssize_t nw = io61_write(outfs[outi], buf, nr);
-            assert(nw == nr);
+            if (nw != nr) {
+                fprintf(stderr, "scattergather61: %s\n", strerror(errno));
+                exit(1);
+            }
             outi = (outi + 1) % outfs.size();
         }
     }
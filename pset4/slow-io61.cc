@@ -14,6 +14,9 @@
 struct io61_file {
     int fd = -1;     // file descriptor
     int mode;        // open mode (O_RDONLY or O_WRONLY)
+    std::vector<unsigned char> line;   // io61_find_delim/reserve storage
+    unsigned char peekc;               // character returned by io61_peek
+    bool peeked = false;               // is `peekc` still unconsumed?
 };
 
 
@@ -47,6 +50,10 @@ int io61_close(io61_file* f) {
 //    which equals -1, on end of file or error.
 
 int io61_readc(io61_file* f) {
+    if (f->peeked) {
+        f->peeked = false;
+        return f->peekc;
+    }
     unsigned char ch;
     ssize_t nr = read(f->fd, &ch, 1);
     if (nr == 1) {
@@ -89,6 +96,111 @@ ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
 }
 
 
+// io61_readline(f, buf, sz)
+//    Reads characters from `f` into `buf` up to and including the next
+//    newline, stopping early at end of file or after `sz` characters.
+//    Returns the number of characters read, 0 at end of file, or -1 if an
+//    error is encountered before any characters are read.
+
+ssize_t io61_readline(io61_file* f, unsigned char* buf, size_t sz) {
+    size_t nread = 0;
+    while (nread != sz) {
+        int ch = io61_readc(f);
+        if (ch == EOF) {
+            break;
+        }
+        buf[nread] = ch;
+        ++nread;
+        if (ch == '\n') {
+            break;
+        }
+    }
+    if (nread != 0 || sz == 0 || errno == 0) {
+        return nread;
+    } else {
+        return -1;
+    }
+}
+
+
+// io61_readv(f, iov, iovcnt)
+//    Reads into the `iovcnt` buffers described by `iov`, in order.
+//    Returns the total number of characters read, 0 at end of file, or -1
+//    if an error is encountered before any characters are read.
+
+ssize_t io61_readv(io61_file* f, const iovec* iov, int iovcnt) {
+    size_t nread = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t nr = io61_read(f, (unsigned char*) iov[i].iov_base,
+                               iov[i].iov_len);
+        if (nr == -1) {
+            return nread != 0 ? nread : -1;
+        }
+        nread += nr;
+        if (nr != (ssize_t) iov[i].iov_len) {
+            break;
+        }
+    }
+    return nread;
+}
+
+
+// io61_find_delim(f, delim, sz, data)
+//    Reads characters from `f` up to and including the first `delim`, at
+//    most `sz` of them, and sets `*data` to point at them. The data stays
+//    valid until the next call on `f`. Returns the number of characters
+//    read, 0 at end of file, or -1 on error.
+
+ssize_t io61_find_delim(io61_file* f, int delim, size_t sz,
+                        const unsigned char** data) {
+    f->line.clear();
+    while (f->line.size() != sz) {
+        int ch = io61_readc(f);
+        if (ch == EOF) {
+            break;
+        }
+        f->line.push_back(ch);
+        if (ch == (unsigned char) delim) {
+            break;
+        }
+    }
+    *data = f->line.data();
+    if (!f->line.empty() || sz == 0 || errno == 0) {
+        return f->line.size();
+    } else {
+        return -1;
+    }
+}
+
+
+// io61_peek(f, data, sz), io61_consume(f, n)
+//    io61_peek sets `*data` and `*sz` to the next character of `f`
+//    without consuming it; `*sz` is 0 at end of file. Returns 0 on
+//    success and -1 on error. io61_consume consumes `n <= *sz` of them.
+
+int io61_peek(io61_file* f, const unsigned char** data, size_t* sz) {
+    if (!f->peeked) {
+        int ch = io61_readc(f);
+        if (ch == EOF) {
+            *sz = 0;
+            return errno == 0 ? 0 : -1;
+        }
+        f->peekc = ch;
+        f->peeked = true;
+    }
+    *data = &f->peekc;
+    *sz = 1;
+    return 0;
+}
+
+void io61_consume(io61_file* f, size_t n) {
+    assert(n <= 1 && (n == 0 || f->peeked));
+    if (n != 0) {
+        f->peeked = false;
+    }
+}
+
+
 // io61_writec(f)
 //    Write a single character `c` to `f` (converted to unsigned char).
 //    Returns 0 on success and -1 on error.
@@ -127,6 +239,120 @@ ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
 }
 
 
+// io61_writev(f, iov, iovcnt)
+//    Writes the `iovcnt` buffers described by `iov` to `f`, in order.
+//    Returns the total number of characters written, or -1 if an error
+//    occurred before any characters were written.
+
+ssize_t io61_writev(io61_file* f, const iovec* iov, int iovcnt) {
+    size_t nwritten = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t nw = io61_write(f, (const unsigned char*) iov[i].iov_base,
+                                iov[i].iov_len);
+        if (nw == -1) {
+            return nwritten != 0 ? nwritten : -1;
+        }
+        nwritten += nw;
+        if (nw != (ssize_t) iov[i].iov_len) {
+            break;
+        }
+    }
+    return nwritten;
+}
+
+
+// io61_reserve(f, data, sz), io61_commit(f, n)
+//    io61_reserve sets `*data` to space for up to `sz` characters and
+//    returns how many fit. io61_commit then writes the first `n` of them
+//    to `f`. Returns 0 on success and -1 on error.
+
+ssize_t io61_reserve(io61_file* f, unsigned char** data, size_t sz) {
+    f->line.resize(sz);
+    *data = f->line.data();
+    return sz;
+}
+
+int io61_commit(io61_file* f, size_t n) {
+    assert(n <= f->line.size());
+    ssize_t nw = io61_write(f, f->line.data(), n);
+    return nw == (ssize_t) n ? 0 : -1;
+}
+
+
+// io61_ready(f, events)
+//    Returns the subset of `events` (POLLIN, POLLOUT) that `f` can serve
+//    without a system call.
+
+int io61_ready(io61_file* f, int events) {
+    return (events & POLLIN) && f->peeked ? POLLIN : 0;
+}
+
+
+// io61_copy(in, out, sz)
+//    Copies up to `sz` characters from `in` to `out`. Returns the number
+//    of characters copied, 0 if `in` was at end of file, or -1 if an
+//    error occurred before any characters were copied.
+
+ssize_t io61_copy(io61_file* in, io61_file* out, size_t sz) {
+    unsigned char buf[BUFSIZ];
+    size_t ncopied = 0;
+    while (ncopied != sz) {
+        ssize_t nr = io61_read(in, buf, std::min(sz - ncopied, sizeof(buf)));
+        if (nr <= 0) {
+            return ncopied == 0 ? nr : ncopied;
+        }
+        ssize_t nw = io61_write(out, buf, nr);
+        if (nw > 0) {
+            ncopied += nw;
+        }
+        if (nw != nr) {
+            return ncopied == 0 ? -1 : ncopied;
+        }
+    }
+    return ncopied;
+}
+
+
+// io61_scatter_gather(infs, outfs, block_size, lines, nthreads)
+//    Copies blocks from the `infs` to the `outfs` in round-robin order,
+//    closing each input at end of file. This version ignores `nthreads`
+//    and copies on the calling thread. Returns 0 on success, or -1 with
+//    `errno` set if a write failed.
+
+int io61_scatter_gather(const std::vector<io61_file*>& infs,
+                        const std::vector<io61_file*>& outfs,
+                        size_t block_size, bool lines, size_t nthreads) {
+    assert(block_size > 0 && !outfs.empty() && nthreads > 0);
+    std::vector<io61_file*> ins = infs;
+    std::vector<unsigned char> buf(block_size);
+    size_t ini = -1, outi = 0;
+    int r = 0, err = 0;
+    while (!ins.empty()) {
+        ini = (ini + 1) % ins.size();
+        ssize_t nr = lines ? io61_readline(ins[ini], buf.data(), block_size)
+            : io61_read(ins[ini], buf.data(), block_size);
+        if (nr <= 0) {
+            io61_close(ins[ini]);
+            ins.erase(ins.begin() + ini);
+            --ini;
+        } else if (io61_write(outfs[outi], buf.data(), nr) != nr) {
+            r = -1;
+            err = errno;
+            break;
+        } else {
+            outi = (outi + 1) % outfs.size();
+        }
+    }
+    for (auto f : ins) {
+        io61_close(f);
+    }
+    if (r == -1) {
+        errno = err;
+    }
+    return r;
+}
+
+
 // io61_flush(f)
 //    If `f` was opened write-only, `io61_flush(f)` forces a write of any
 //    cached data written to `f`. Returns 0 on success; returns -1 if an error
@@ -146,6 +372,7 @@ int io61_flush(io61_file* f) {
 //    Returns 0 on success and -1 on failure.
 
 int io61_seek(io61_file* f, off_t off) {
+    f->peeked = false;
     off_t r = lseek(f->fd, (off_t) off, SEEK_SET);
     // Ignore the returned offset unless it’s an error.
     if (r == -1) {
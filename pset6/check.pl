@@ -495,6 +495,61 @@ if (testid_runnable("FTX5")) {
     run_one_check("./ftxxfer bigaccounts.fdb", "./diff-ftxdb.pl bigaccounts.fdb");
 }
 
+if (testid_runnable("FTX6")) {
+    print OUT "\n${Cyan}Test FTX6: ./ftxxfer -b 100 bigaccounts.fdb check...${Off}\n";
+    run_one_check("./ftxxfer -b 100 bigaccounts.fdb", "./diff-ftxdb.pl bigaccounts.fdb");
+}
+
+if (testid_runnable("FTX7")) {
+    print OUT "\n${Cyan}Test FTX7: ./ftxrocket -m memory -J2 bigaccounts.fdb check...${Off}\n";
+    run_one_check("./ftxrocket -m memory -J2 bigaccounts.fdb", "./diff-ftxdb.pl bigaccounts.fdb");
+}
+
+# Optimistic mode checks correctness here, not speed: every thread pays
+# the modeled delay per transfer, so it runs about as long as FTX3. It
+# only gains when contention is low; hot accounts fall back to claiming.
+if (testid_runnable("FTX8")) {
+    print OUT "\n${Cyan}Test FTX8: ./ftxrocket -m optimistic -J2 check...${Off}\n";
+    run_one_check("./ftxrocket -m optimistic -J2", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("FTX9")) {
+    print OUT "\n${Cyan}Test FTX9: ./ftxrocket -H -J3 check...${Off}\n";
+    run_one_check("./ftxrocket -H -J3", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("FTX10")) {
+    print OUT "\n${Cyan}Test FTX10: ./ftxblockchain -S check...${Off}\n";
+    run_one_check("./ftxblockchain -S -n 20000", "./diff-ftxdb.pl -l");
+}
+
+if (testid_runnable("FTX11")) {
+    print OUT "\n${Cyan}Test FTX11: ./ftxrocket -m wal -S -J2 check...${Off}\n";
+    run_one_check("./ftxrocket -m wal -S -J2 -n 20000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("FTX12")) {
+    print OUT "\n${Cyan}Test FTX12: ./ftxxfer -m wal crash recovery check...${Off}\n";
+    # Kill the run once the log holds committed records, check that it was
+    # still running, recover, and check that recovery kept some transfers
+    run_one_check("cp accounts.fdb /tmp/newaccounts.fdb && rm -f /tmp/newaccounts.fdb.wal && { ./ftxxfer -m wal -M -i /tmp/newaccounts.fdb & pid=\$!; while [ \"\$( (wc -c < /tmp/newaccounts.fdb.wal) 2>/dev/null || echo 0)\" -le 16 ]; do sleep 0.01; done; kill -9 \$pid; wait \$pid; [ \$? -eq 137 ] || { echo 'ftxxfer exited before it was killed'; exit 1; }; ./ftxxfer -m wal -M -n 0 -i /tmp/newaccounts.fdb || exit 1; ! cmp -s accounts.fdb /tmp/newaccounts.fdb || { echo 'recovery lost every transfer'; exit 1; }; }", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("FTX13")) {
+    print OUT "\n${Cyan}Test FTX13: ./ftxxfer binary bigaccounts check...${Off}\n";
+    run_one_check("./ftxconvert -o /tmp/accounts.bdb bigaccounts.fdb && ./ftxxfer /tmp/accounts.bdb", "./ftxconvert /tmp/newaccounts.fdb | ./diff-ftxdb.pl bigaccounts.fdb -");
+}
+
+if (testid_runnable("FTX14")) {
+    print OUT "\n${Cyan}Test FTX14: ./ftxrocket -m wal -J2 binary check...${Off}\n";
+    run_one_check("./ftxconvert -o /tmp/accounts.bdb accounts.fdb && ./ftxrocket -m wal -J2 -n 20000 /tmp/accounts.bdb", "./ftxconvert /tmp/newaccounts.fdb | ./diff-ftxdb.pl accounts.fdb -");
+}
+
+if (testid_runnable("FTX15")) {
+    print OUT "\n${Cyan}Test FTX15: ./ftxrocket -m mmap -J2 bigaccounts.fdb check...${Off}\n";
+    run_one_check("./ftxrocket -m mmap -J2 bigaccounts.fdb", "./diff-ftxdb.pl bigaccounts.fdb");
+}
+
 
 set_param("SAN", 1);
 
@@ -513,4 +568,29 @@ if (testid_runnable("SAN3")) {
     run_one_check("./ftxxfer -n 10000 bigaccounts.fdb", "./diff-ftxdb.pl bigaccounts.fdb");
 }
 
+if (testid_runnable("SAN4")) {
+    print OUT "\n${Cyan}Test SAN4: ./ftxrocket -m memory check with sanitizers...${Off}\n";
+    run_one_check("./ftxrocket -m memory -n 10000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("SAN5")) {
+    print OUT "\n${Cyan}Test SAN5: ./ftxrocket -m optimistic -J2 check with sanitizers...${Off}\n";
+    run_one_check("./ftxrocket -m optimistic -J2 -n 10000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("SAN6")) {
+    print OUT "\n${Cyan}Test SAN6: ./ftxrocket -m memory -H -J3 check with sanitizers...${Off}\n";
+    run_one_check("./ftxrocket -m memory -H -J3 -n 10000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("SAN7")) {
+    print OUT "\n${Cyan}Test SAN7: ./ftxblockchain -m wal -S check with sanitizers...${Off}\n";
+    run_one_check("./ftxblockchain -m wal -S -n 10000", "./diff-ftxdb.pl -l");
+}
+
+if (testid_runnable("SAN8")) {
+    print OUT "\n${Cyan}Test SAN8: ./ftxxfer -m mmap binary check with sanitizers...${Off}\n";
+    run_one_check("./ftxconvert -o /tmp/accounts.bdb accounts.fdb && ./ftxxfer -m mmap -n 10000 /tmp/accounts.bdb", "./ftxconvert /tmp/newaccounts.fdb | ./diff-ftxdb.pl accounts.fdb -");
+}
+
 exit(0);
@@ -2,12 +2,151 @@
 #include <sys/resource.h>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <sched.h>
 
-// Usage: ./ftxblockchain [-j NTHREADS] [-n NOPS] [FILE]
+// Usage: ./ftxblockchain [-b BLOCKSIZE] [-m MODE] [-M] [-S] [-j NTHREADS] [-n NOPS] [FILE]
 //    Perform NOPS * NTHREADS “bank transfers” within FILE, writing
-//    a ledger to LEDGER (defaults to ledger.db).
+//    a ledger to LEDGER (defaults to ledger.db). With `-S`, the ledger
+//    is synced to disk after every group of records, and each transfer
+//    waits for its record to be synced.
+
+
+// ftx_ledger
+//    Group-commit ledger. Transfer threads append records to a bounded
+//    ring without taking locks; one writer thread collects every record
+//    that is ready and writes the group with one call, optionally
+//    followed by `fdatasync`. Records reach the file in append order.
+//    A slot for position `pos` is free when its `seq` equals `pos`, and
+//    holds a record when its `seq` equals `pos + 1`. In sync mode,
+//    records before position `durable` have been synced.
+
+struct alignas(64) ftx_ledger_slot {
+    std::atomic<size_t> seq;
+    size_t len;
+    char rec[128];
+};
+
+struct ftx_ledger {
+    static constexpr size_t nslots = 1024;
+    ftx_ledger_slot slots[nslots];
+    alignas(64) std::atomic<size_t> tail = 0;      // next position to fill
+    alignas(64) std::atomic<unsigned> nposted = 0; // bumped to wake writer
+    alignas(64) std::atomic<size_t> durable = 0;   // synced positions
+    std::atomic<bool> done = false;
+    io61_file* f;
+    bool sync;
+    std::thread writer;
+};
+
+static ftx_ledger* ledger;
+
+
+// ledger_append(l, rec, len)
+//    Append a record to ledger `l` and return its position. Blocks only
+//    if the ring is full.
+
+static size_t ledger_append(ftx_ledger& l, const char* rec, size_t len) {
+    assert(len <= sizeof(l.slots[0].rec));
+    size_t pos = l.tail.fetch_add(1, std::memory_order_relaxed);
+    ftx_ledger_slot& s = l.slots[pos % ftx_ledger::nslots];
+    while (s.seq.load(std::memory_order_acquire) != pos) {
+        sched_yield();
+    }
+    memcpy(s.rec, rec, len);
+    s.len = len;
+    s.seq.store(pos + 1, std::memory_order_release);
+    l.nposted.fetch_add(1, std::memory_order_release);
+    l.nposted.notify_one();
+    return pos;
+}
+
+
+// ledger_wait_durable(l, pos)
+//    In sync mode, block until the record at position `pos` is synced.
+//    Call without holding account locks, so other transfers can proceed
+//    while this one waits.
+
+static void ledger_wait_durable(ftx_ledger& l, size_t pos) {
+    if (!l.sync) {
+        return;
+    }
+    size_t durable = l.durable.load(std::memory_order_acquire);
+    while (durable <= pos) {
+        l.durable.wait(durable);
+        durable = l.durable.load(std::memory_order_acquire);
+    }
+}
+
+
+// ledger_writer(l)
+//    Body of the writer thread: write groups of records until the ledger
+//    is closed and drained.
+
+static void ledger_writer(ftx_ledger& l) {
+    std::vector<char> group;
+    group.reserve(ftx_ledger::nslots * sizeof(l.slots[0].rec));
+    size_t head = 0;
+    while (true) {
+        unsigned nposted = l.nposted.load(std::memory_order_acquire);
+
+        // Collect ready records in order, at most one ring’s worth
+        group.clear();
+        for (size_t n = 0; n != ftx_ledger::nslots; ++n, ++head) {
+            ftx_ledger_slot& s = l.slots[head % ftx_ledger::nslots];
+            if (s.seq.load(std::memory_order_acquire) != head + 1) {
+                break;
+            }
+            group.insert(group.end(), s.rec, s.rec + s.len);
+            s.seq.store(head + ftx_ledger::nslots, std::memory_order_release);
+        }
 
-static io61_file* ledgerf;
+        if (!group.empty()) {
+            ssize_t nw = io61_write(l.f, group.data(), group.size());
+            assert(nw == ssize_t(group.size()));
+            if (l.sync) {
+                int r = io61_flush(l.f);
+                assert(r == 0);
+                r = fdatasync(io61_fileno(l.f));
+                assert(r == 0);
+                l.durable.store(head, std::memory_order_release);
+                l.durable.notify_all();
+            }
+        } else if (l.done && head == l.tail.load()) {
+            return;
+        } else if (head == l.tail.load()) {
+            l.nposted.wait(nposted);
+        } else {
+            // a record is reserved but not yet filled
+            sched_yield();
+        }
+    }
+}
+
+
+// ledger_open(f, sync), ledger_close(l)
+//    Start and stop a group-commit ledger writing to `f`. Closing waits
+//    for every appended record to be written, then closes `f`.
+
+static ftx_ledger* ledger_open(io61_file* f, bool sync) {
+    ftx_ledger* l = new ftx_ledger;
+    for (size_t i = 0; i != ftx_ledger::nslots; ++i) {
+        l->slots[i].seq = i;
+    }
+    l->f = f;
+    l->sync = sync;
+    l->writer = std::thread(ledger_writer, std::ref(*l));
+    return l;
+}
+
+static void ledger_close(ftx_ledger* l) {
+    l->done = true;
+    l->nposted.fetch_add(1);
+    l->nposted.notify_one();
+    l->writer.join();
+    io61_close(l->f);
+    delete l;
+}
 
 static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
                             unsigned seed) {
@@ -38,14 +177,9 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
         acct1.read(name1, sizeof(name1), &bal[0]);
         acct2.read(name2, sizeof(name2), &bal[1]);
 
-        // Model network delay or heavy computation
-        usleep(1);
-
-        // Compute amount to transfer
-        long delta = std::min(bal[0], (long) pick_amount(randomness));
-        delta = std::min(delta, 9999999 - bal[1]);
-        bal[0] -= delta;
-        bal[1] += delta;
+        // Model network delay or heavy computation, then compute the
+        // amount to transfer
+        long delta = ftx_compute_transfer(bal, (long) pick_amount(randomness));
 
         // Update balances
         acct1.write(bal[0]);
@@ -57,9 +191,11 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
                             "%-7s %+7ld\n%-7s %+7ld\n",
                             name1, -delta, name2, +delta);
         assert(n == db.asize * 2 && n < sizeof(report));
-        ssize_t np = io61_write(ledgerf, report, n);
-        assert(np == ssize_t(n));
+        size_t pos = ledger_append(*ledger, report, n);
 
+        guard2.unlock();
+        guard1.unlock();
+        ledger_wait_durable(*ledger, pos);
         ++i;
     }
     opcount = i;
@@ -68,7 +204,7 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_args args = io61_args("i:D:j:n:").set_nthreads(4)
+    io61_args args = io61_args("b:i:D:j:n:m:SM").set_nthreads(4)
         .set_noperations(100'000)
         .parse(argc, argv);
 
@@ -78,8 +214,10 @@ int main(int argc, char* argv[]) {
     if (!args.output_file) {
         args.output_file = "/tmp/ledger.fdb";
     }
-    ledgerf = io61_open_check(args.output_file, O_WRONLY | O_CREAT | O_TRUNC);
+    io61_file* ledgerf = io61_open_check(args.output_file,
+                                         O_WRONLY | O_CREAT | O_TRUNC);
     args.after_open(ledgerf, O_WRONLY);
+    ledger = ledger_open(ledgerf, args.sync);
     std::random_device seed_randomness;
     double start_time = monotonic_timestamp();
 
@@ -100,7 +238,7 @@ int main(int argc, char* argv[]) {
 
     // Flush and close
     delete db;
-    io61_close(ledgerf);
+    ledger_close(ledger);
 
     double end_time = monotonic_timestamp();
     struct rusage usage;
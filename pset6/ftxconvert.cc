@@ -0,0 +1,61 @@
+#include "ftxdb.hh"
+
+// Usage: ./ftxconvert [-o OUTFILE] [FILE]
+//    Convert account file FILE (default accounts.fdb) between the text
+//    format and the binary format (see `ftx_bin_header` in ftxdb.hh),
+//    writing the result to OUTFILE or standard output. The input format
+//    is detected automatically; the output is the other one. To check a
+//    binary result, convert it back to text:
+//    `./ftxconvert /tmp/newaccounts.bdb | ./diff-ftxdb.pl accounts.fdb -`
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("i:o:").parse(argc, argv);
+    const char* fname = args.input_file ? args.input_file : "accounts.fdb";
+
+    // Open files (positioned io61 reads need O_RDWR; FILE is not changed)
+    ftx_db db(io61_open_check(fname, O_RDWR));
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    args.after_open(outf, O_WRONLY);
+
+    if (!db.binary) {
+        ftx_bin_header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, ftx_bin_magic, sizeof(h.magic));
+        h.version = ftx_bin_version;
+        h.asize = sizeof(ftx_bin_acct);
+        h.naccounts = db.naccounts;
+        io61_write(outf, reinterpret_cast<const char*>(&h), sizeof(h));
+    }
+
+    for (size_t i = 0; i != db.naccounts; ++i) {
+        ftx_acct acct(db, i);
+        char name[16];
+        long balance;
+        if (acct.read(name, sizeof(name), &balance) != 0) {
+            fprintf(stderr, "%s: account %zu: %s\n", fname, i, strerror(errno));
+            exit(1);
+        }
+
+        if (!db.binary) {
+            ftx_bin_acct rec;
+            memset(&rec, 0, sizeof(rec));
+            memcpy(rec.name, name, strlen(name));
+            rec.balance = balance;
+            io61_write(outf, reinterpret_cast<const char*>(&rec), sizeof(rec));
+        } else {
+            // Text records are `%-7s %7ld\n`: 16 bytes, balance at 8
+            char line[64];
+            int n = snprintf(line, sizeof(line), "%-7s %7ld\n", name, balance);
+            if (strlen(name) > 7 || n != 16) {
+                fprintf(stderr, "%s: account %zu does not fit the text format\n",
+                        fname, i);
+                exit(1);
+            }
+            io61_write(outf, line, n);
+        }
+    }
+
+    io61_close(outf);
+}
@@ -1,11 +1,64 @@
 #ifndef FTXDB_HH
 #define FTXDB_HH
 #include "io61.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <random>
 #include <stdexcept>
 #include <utility>
 struct ftx_acct;
+struct ftx_wal;
+
+
+// ftx_mem_acct
+//    An account held in memory (`-m memory`, `wal`, or `optimistic`). Each
+//    account has its own lock and is padded to a cache line, so threads
+//    working on nearby accounts do not contend for the same line.
+//    Optimistic transfers skip `m` and use `version` instead: it is odd
+//    while a commit is updating the balance.
+
+struct alignas(64) ftx_mem_acct {
+    std::mutex m;
+    std::atomic<long> balance;
+    std::atomic<unsigned long> version = 0;
+};
+
+
+// ftx_acct_lock
+//    A per-account lock for mmap mode (`-m mmap`), padded to a cache line.
+
+struct alignas(64) ftx_acct_lock {
+    std::mutex m;
+};
+
+
+// ftx_bin_header, ftx_bin_acct
+//    Binary account files start with an `ftx_bin_header`, followed by
+//    `naccounts` fixed-width `ftx_bin_acct` records in host byte order.
+//    Names are NUL-padded. Records are 16 bytes and the header is a
+//    cache line, so no record straddles a cache line, and balances are
+//    read and written as plain 8-byte integers with no parsing.
+//    `ftxconvert` converts between this format and text.
+
+struct ftx_bin_header {
+    char magic[8];             // `ftx_bin_magic`
+    uint32_t version;          // `ftx_bin_version`
+    uint32_t asize;            // `sizeof(ftx_bin_acct)`
+    uint64_t naccounts;
+    char padding[40];
+};
+
+struct ftx_bin_acct {
+    char name[8];
+    int64_t balance;
+};
+
+static_assert(sizeof(ftx_bin_header) == 64 && sizeof(ftx_bin_acct) == 16);
+inline constexpr char ftx_bin_magic[8] = {'F', 'T', 'X', 'B', 'I', 'N', 0, 0};
+inline constexpr uint32_t ftx_bin_version = 1;
 
 
 // ftx_db
@@ -17,11 +70,41 @@ struct ftx_db {
     size_t asize = 16;         // size of an account record
     size_t balance_offset = 8; // offset of balance field within record
     size_t balance_size = 7;   // size of balance field within record
+    off_t data_offset = 0;     // offset of first record
+    bool binary = false;       // binary format (`ftx_bin_acct` records)?
     static constexpr size_t max_asize = 512; // maximum asize allowed
 
+    // Memory mode: balances live in `mem`, and `image` holds the file’s
+    // records, whose balances are refreshed by `checkpoint`
+    std::unique_ptr<ftx_mem_acct[]> mem;
+    std::unique_ptr<char[]> image;
+    long min_balance;          // smallest balance that fits in a record
+    long max_balance;          // largest balance that fits in a record
+    std::mutex checkpoint_m;   // serializes checkpoints
+    bool optimistic = false;   // use `ftx_optimistic_transfer`?
+
+    // WAL mode: memory mode plus a redo log (see ftxhelpers.cc)
+    ftx_wal* wal = nullptr;
+
+    // mmap mode: records are read and written in place in a shared
+    // mapping of the file, under per-account locks
+    char* mapped = nullptr;
+    size_t mapped_size = 0;
+    std::unique_ptr<ftx_acct_lock[]> locks;
+
     ftx_db(io61_file* f);
     ~ftx_db();
     static ftx_db* open_args(const io61_args& args);
+
+    int load();
+    int map();
+    int checkpoint();
+
+    int wal_open(const char* fname, bool fresh, bool sync);
+    void wal_locked() const;
+    void wal_write(size_t aindex, long balance) const;
+    void wal_commit() const;
+    void wal_unlocked() const;
 };
 
 
@@ -30,6 +113,7 @@ struct ftx_db {
 
 struct ftx_acct {
     const ftx_db& db;
+    size_t aindex;
     off_t offset;
     bool locked = false;
 
@@ -40,6 +124,12 @@ struct ftx_acct {
     inline int read(char* namebuf, size_t namesz, long* balance) const;
     inline int write(long balance) const;
 
+    inline bool read_versioned(long* balance, unsigned long* version) const;
+    static inline int commit_versioned(
+        const ftx_acct& a1, unsigned long v1, long balance1,
+        const ftx_acct& a2, unsigned long v2, long balance2
+    );
+
     static int parse(
         const char* buf, size_t len, const ftx_db& db,
         char* namebuf, size_t namesz, long* balance
@@ -51,18 +141,27 @@ struct ftx_acct {
 
 
 // Create an account object for account number `aindex`
-inline ftx_acct::ftx_acct(const ftx_db& db_, size_t aindex)
-    : db(db_) {
+inline ftx_acct::ftx_acct(const ftx_db& db_, size_t aindex_)
+    : db(db_), aindex(aindex_) {
     assert(aindex < this->db.naccounts);
-    this->offset = aindex * this->db.asize;
+    this->offset = this->db.data_offset + aindex * this->db.asize;
 }
 
 
 // Lock this account
 inline void ftx_acct::lock() {
     assert(!this->locked);
-    int r = io61_lock(this->db.f, this->offset, this->db.asize, LOCK_EX);
-    assert(r == 0);
+    if (this->db.mem) {
+        this->db.mem[this->aindex].m.lock();
+        if (this->db.wal) {
+            this->db.wal_locked();
+        }
+    } else if (this->db.mapped) {
+        this->db.locks[this->aindex].m.lock();
+    } else {
+        int r = io61_lock(this->db.f, this->offset, this->db.asize, LOCK_EX);
+        assert(r == 0);
+    }
     this->locked = true;
 }
 
@@ -70,8 +169,19 @@ inline void ftx_acct::lock() {
 // Unlock this account
 inline void ftx_acct::unlock() {
     assert(this->locked);
-    int r = io61_unlock(this->db.f, this->offset, this->db.asize);
-    assert(r == 0);
+    if (this->db.wal) {
+        // Log this thread’s writes before any lock is released
+        this->db.wal_commit();
+        this->db.mem[this->aindex].m.unlock();
+        this->db.wal_unlocked();
+    } else if (this->db.mem) {
+        this->db.mem[this->aindex].m.unlock();
+    } else if (this->db.mapped) {
+        this->db.locks[this->aindex].m.unlock();
+    } else {
+        int r = io61_unlock(this->db.f, this->offset, this->db.asize);
+        assert(r == 0);
+    }
     this->locked = false;
 }
 
@@ -79,6 +189,67 @@ inline void ftx_acct::unlock() {
 // Read this account’s current name and/or balance, storing the name
 // in `namebuf[0..namesz-1]` and the balance in `*balance`
 inline int ftx_acct::read(char* namebuf, size_t namesz, long* balance) const {
+    // In memory mode, names come from the file image and balances
+    // from memory; no parsing of balances is needed
+    if (this->db.mem) {
+        int r = 0;
+        if (namebuf && namesz > 0) {
+            r = parse(&this->db.image[this->aindex * this->db.asize],
+                      this->db.asize, this->db, namebuf, namesz, nullptr);
+        }
+        if (balance) {
+            *balance = this->db.mem[this->aindex].balance.load(std::memory_order_relaxed);
+        }
+        return r;
+    }
+
+    // In mmap mode, read the record in place
+    if (this->db.mapped) {
+        const char* rec = &this->db.mapped[this->offset];
+        if (!this->db.binary || (namebuf && namesz > 0)) {
+            return parse(rec, this->db.asize, this->db,
+                         namebuf, namesz, balance);
+        }
+        if (balance) {
+            int64_t b;
+            memcpy(&b, rec + this->db.balance_offset, sizeof(b));
+            *balance = b;
+        }
+        return 0;
+    }
+
+    // Binary records need no parsing; read only the balance if that is
+    // all the caller wants
+    if (this->db.binary) {
+        ftx_bin_acct rec;
+        ssize_t nr;
+        if (namebuf && namesz > 0) {
+            nr = io61_pread(this->db.f, reinterpret_cast<char*>(&rec),
+                            sizeof(rec), this->offset);
+        } else {
+            nr = io61_pread(this->db.f, reinterpret_cast<char*>(&rec.balance),
+                            sizeof(rec.balance),
+                            this->offset + this->db.balance_offset);
+            nr = nr == ssize_t(sizeof(rec.balance)) ? sizeof(rec) : nr;
+        }
+        if (nr == 0 || nr == -1) {
+            return nr;
+        } else if (nr != ssize_t(sizeof(rec))) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (namebuf && namesz > 0) {
+            size_t len = std::min(strnlen(rec.name, sizeof(rec.name)),
+                                  namesz - 1);
+            memcpy(namebuf, rec.name, len);
+            namebuf[len] = '\0';
+        }
+        if (balance) {
+            *balance = rec.balance;
+        }
+        return 0;
+    }
+
     // Read account from file; short reads are errors
     char buf[ftx_db::max_asize];
     ssize_t nr = io61_pread(this->db.f, buf, this->db.asize, this->offset);
@@ -93,6 +264,48 @@ inline int ftx_acct::read(char* namebuf, size_t namesz, long* balance) const {
 
 // Write `balance` to the account database as this account’s new balance
 inline int ftx_acct::write(long balance) const {
+    // In memory mode, update the in-memory balance
+    if (this->db.mem) {
+        if (balance < this->db.min_balance || balance > this->db.max_balance) {
+            errno = EOVERFLOW;
+            return -1;
+        }
+        this->db.mem[this->aindex].balance.store(balance, std::memory_order_relaxed);
+        if (this->db.wal) {
+            this->db.wal_write(this->aindex, balance);
+        }
+        return 0;
+    }
+
+    // In mmap mode, store the balance in place
+    if (this->db.mapped) {
+        char* p = &this->db.mapped[this->offset + this->db.balance_offset];
+        if (this->db.binary) {
+            int64_t b = balance;
+            memcpy(p, &b, sizeof(b));
+            return 0;
+        }
+        char buf[ftx_db::max_asize];
+        auto [ptr, len] = unparse(buf, sizeof(buf), this->db, balance);
+        if (len == 0) {
+            return -1;
+        }
+        memcpy(p, ptr, len);
+        return 0;
+    }
+
+    // Store binary balances directly
+    if (this->db.binary) {
+        int64_t b = balance;
+        ssize_t nw = io61_pwrite(this->db.f, reinterpret_cast<char*>(&b), sizeof(b),
+                                 this->offset + this->db.balance_offset);
+        if (nw != ssize_t(sizeof(b))) {
+            errno = EINVAL;
+            return -1;
+        }
+        return 0;
+    }
+
     // Stringify balance to stack buffer
     char buf[ftx_db::max_asize];
     auto [ptr, len] = unparse(buf, sizeof(buf), this->db, balance);
@@ -111,4 +324,175 @@ inline int ftx_acct::write(long balance) const {
     }
 }
 
+
+// Read this account’s balance and version without locking (optimistic
+// mode). Returns false if a commit was in progress; the caller should
+// retry.
+inline bool ftx_acct::read_versioned(long* balance,
+                                     unsigned long* version) const {
+    assert(this->db.mem);
+    ftx_mem_acct& a = this->db.mem[this->aindex];
+    unsigned long v = a.version.load(std::memory_order_acquire);
+    if (v & 1) {
+        return false;
+    }
+    // The acquire load keeps the version recheck from moving earlier
+    *balance = a.balance.load(std::memory_order_acquire);
+    if (a.version.load(std::memory_order_relaxed) != v) {
+        return false;
+    }
+    *version = v;
+    return true;
+}
+
+
+// Atomically set the balances of `a1` and `a2`, provided neither has
+// changed since `read_versioned` returned versions `v1` and `v2`.
+// Returns 1 on success. Returns 0, changing nothing, if either has
+// changed, and -1, changing nothing, if a balance is out of range.
+// Never blocks.
+inline int ftx_acct::commit_versioned(
+    const ftx_acct& a1, unsigned long v1, long balance1,
+    const ftx_acct& a2, unsigned long v2, long balance2
+) {
+    assert(a1.db.mem && &a1.db == &a2.db && a1.aindex != a2.aindex);
+    if (balance1 < a1.db.min_balance || balance1 > a1.db.max_balance
+        || balance2 < a2.db.min_balance || balance2 > a2.db.max_balance) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    ftx_mem_acct& m1 = a1.db.mem[a1.aindex];
+    ftx_mem_acct& m2 = a2.db.mem[a2.aindex];
+
+    // Claim both versions (marking them odd), then publish
+    if (!m1.version.compare_exchange_strong(v1, v1 + 1,
+                                            std::memory_order_acquire)) {
+        return 0;
+    }
+    if (!m2.version.compare_exchange_strong(v2, v2 + 1,
+                                            std::memory_order_acquire)) {
+        m1.version.store(v1, std::memory_order_release);
+        return 0;
+    }
+    m1.balance.store(balance1, std::memory_order_release);
+    m2.balance.store(balance2, std::memory_order_release);
+    m1.version.store(v1 + 2, std::memory_order_release);
+    m2.version.store(v2 + 2, std::memory_order_release);
+    return 1;
+}
+
+
+// ftx_move_balance(from, to, amount)
+//    Move up to `amount` from balance `from` to balance `to`, never
+//    overdrawing `from` or taking `to` past 9999999. Returns the amount
+//    moved. Every transfer path limits its transfers with this.
+
+inline long ftx_move_balance(long& from, long& to, long amount) {
+    long delta = std::min(from, amount);
+    delta = std::min(delta, 9999999 - to);
+    from -= delta;
+    to += delta;
+    return delta;
+}
+
+
+// ftx_compute_transfer(bal, amount)
+//    Model network delay or heavy computation, then move up to `amount`
+//    from `bal[0]` to `bal[1]` with `ftx_move_balance`. Returns the
+//    amount moved.
+
+inline long ftx_compute_transfer(long bal[2], long amount) {
+    usleep(1);
+    return ftx_move_balance(bal[0], bal[1], amount);
+}
+
+
+// ftx_exclusive_transfer(acct1, acct2, amount)
+//    Transfer up to `amount` from `acct1` to `acct2` in optimistic mode,
+//    using the version words as locks. Claims both versions (marking them
+//    odd) in account order, waiting while other commits are in progress,
+//    then runs `ftx_compute_transfer` and publishes the result. Other
+//    threads' optimistic commits fail meanwhile, so this cannot conflict.
+//    Returns 0 on success and -1, changing nothing, if a resulting balance
+//    is out of range.
+
+inline int ftx_exclusive_transfer(const ftx_acct& acct1,
+                                  const ftx_acct& acct2, long amount) {
+    assert(acct1.db.mem && &acct1.db == &acct2.db
+           && acct1.aindex != acct2.aindex);
+    ftx_mem_acct* m[2] = {
+        &acct1.db.mem[acct1.aindex], &acct2.db.mem[acct2.aindex]
+    };
+    unsigned long v[2];
+    bool swapped = acct1.aindex > acct2.aindex;
+    for (int i = 0; i != 2; ++i) {
+        int j = i ^ swapped;
+        v[j] = m[j]->version.load(std::memory_order_relaxed);
+        while ((v[j] & 1)
+               || !m[j]->version.compare_exchange_weak(
+                      v[j], v[j] + 1, std::memory_order_acquire)) {
+            sched_yield();
+            v[j] = m[j]->version.load(std::memory_order_relaxed);
+        }
+    }
+
+    long bal[2] = {
+        m[0]->balance.load(std::memory_order_relaxed),
+        m[1]->balance.load(std::memory_order_relaxed)
+    };
+    ftx_compute_transfer(bal, amount);
+    const ftx_db& db = acct1.db;
+    bool ok = bal[0] >= db.min_balance && bal[0] <= db.max_balance
+        && bal[1] >= db.min_balance && bal[1] <= db.max_balance;
+    for (int i = 0; i != 2; ++i) {
+        if (ok) {
+            m[i]->balance.store(bal[i], std::memory_order_release);
+        }
+        m[i]->version.store(v[i] + (ok ? 2 : 0), std::memory_order_release);
+    }
+    if (!ok) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    return 0;
+}
+
+
+// ftx_optimistic_transfer(acct1, acct2, amount)
+//    Transfer up to `amount` from `acct1` to `acct2` without holding
+//    locks. Reads both balances, runs `ftx_compute_transfer`, and commits
+//    the result if neither account changed meanwhile. Only the commit
+//    itself excludes other threads, so slow computations overlap when
+//    accounts are rarely shared. On a conflict it backs off exponentially
+//    and starts over; after `ftx_optimistic_attempts` conflicts it falls
+//    back to `ftx_exclusive_transfer`, so hot accounts cost no more than
+//    locking. Returns 0 on success and -1 if a resulting balance is out
+//    of range.
+
+constexpr int ftx_optimistic_attempts = 4;
+
+inline int ftx_optimistic_transfer(const ftx_acct& acct1,
+                                   const ftx_acct& acct2, long amount) {
+    for (int attempt = 0; attempt != ftx_optimistic_attempts; ++attempt) {
+        if (attempt != 0) {
+            for (int i = 0; i != 1 << attempt; ++i) {
+                sched_yield();
+            }
+        }
+        long bal[2];
+        unsigned long version[2];
+        if (!acct1.read_versioned(&bal[0], &version[0])
+            || !acct2.read_versioned(&bal[1], &version[1])) {
+            continue;
+        }
+        ftx_compute_transfer(bal, amount);
+        int r = ftx_acct::commit_versioned(acct1, version[0], bal[0],
+                                           acct2, version[1], bal[1]);
+        if (r != 0) {
+            return r == 1 ? 0 : -1;
+        }
+    }
+    return ftx_exclusive_transfer(acct1, acct2, amount);
+}
+
 #endif
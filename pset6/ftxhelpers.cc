@@ -1,10 +1,33 @@
 #include "ftxdb.hh"
 #include <charconv>
+#include <climits>
+#include <cstddef>
 #include <cstdlib>
+#include <cstdint>
+#include <condition_variable>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 ftx_db::ftx_db(io61_file* f_) {
     this->f = f_;
     size_t sz = io61_filesize(this->f);
+
+    // Binary account files start with a header
+    ftx_bin_header h;
+    if (sz >= sizeof(h)
+        && io61_pread(this->f, reinterpret_cast<char*>(&h), sizeof(h), 0) == ssize_t(sizeof(h))
+        && memcmp(h.magic, ftx_bin_magic, sizeof(h.magic)) == 0) {
+        assert(h.version == ftx_bin_version);
+        assert(h.asize == sizeof(ftx_bin_acct));
+        this->binary = true;
+        this->asize = sizeof(ftx_bin_acct);
+        this->balance_offset = offsetof(ftx_bin_acct, balance);
+        this->balance_size = sizeof(int64_t);
+        this->data_offset = sizeof(h);
+        sz -= sizeof(h);
+        assert(sz == h.naccounts * this->asize);
+    }
     assert(sz % this->asize == 0);
     this->naccounts = sz / this->asize;
 
@@ -17,16 +40,543 @@ ftx_db::ftx_db(io61_file* f_) {
     assert(balance >= 0);
 }
 
+static void wal_close(ftx_wal* wal);
+
 ftx_db::~ftx_db() {
+    if (this->wal) {
+        wal_close(this->wal);
+    } else if (this->mem || this->mapped) {
+        int r = this->checkpoint();
+        assert(r == 0);
+    }
+    if (this->mapped) {
+        munmap(this->mapped, this->mapped_size);
+    }
     io61_close(this->f);
 }
 
 
+// ftx_db::load()
+//    Switch to memory mode: read every record into `image` and every
+//    balance into `mem`. Returns 0 on success, -1 on error.
+
+int ftx_db::load() {
+    size_t sz = this->naccounts * this->asize;
+    this->image.reset(new char[sz]);
+    size_t nread = 0;
+    while (nread != sz) {
+        ssize_t nr = io61_pread(this->f, &this->image[nread], sz - nread,
+                                this->data_offset + nread);
+        if (nr == 0) {
+            errno = EINVAL;
+        }
+        if (nr <= 0) {
+            this->image.reset();
+            return -1;
+        }
+        nread += nr;
+    }
+
+    // Text balances must fit back into `balance_size` characters
+    if (this->binary) {
+        this->max_balance = LONG_MAX;
+        this->min_balance = LONG_MIN;
+    } else {
+        this->max_balance = 9;
+        for (size_t i = 1; i != this->balance_size; ++i) {
+            this->max_balance = this->max_balance * 10 + 9;
+        }
+        this->min_balance = -(this->max_balance / 10);
+    }
+
+    std::unique_ptr<ftx_mem_acct[]> accts(new ftx_mem_acct[this->naccounts]);
+    for (size_t i = 0; i != this->naccounts; ++i) {
+        long balance;
+        if (ftx_acct::parse(&this->image[i * this->asize], this->asize,
+                            *this, nullptr, 0, &balance) == -1) {
+            this->image.reset();
+            return -1;
+        }
+        accts[i].balance = balance;
+    }
+    this->mem = std::move(accts);
+    return 0;
+}
+
+
+// ftx_db::map()
+//    Switch to mmap mode: map the whole file shared, so `ftx_acct::read`
+//    and `write` access records in place without going through io61.
+//    The io61 file must hold no dirty data. Returns 0 on success, -1 on
+//    error.
+
+int ftx_db::map() {
+    assert(!this->mem && !this->mapped);
+    int r = io61_flush(this->f);
+    if (r == -1) {
+        return -1;
+    }
+    size_t sz = this->data_offset + this->naccounts * this->asize;
+    void* p = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   io61_fileno(this->f), 0);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    this->locks.reset(new ftx_acct_lock[this->naccounts]);
+    this->mapped = reinterpret_cast<char*>(p);
+    this->mapped_size = sz;
+    return 0;
+}
+
+
+// image_store(db, i, balance), image_write(db)
+//    Memory-mode helpers: store account `i`’s balance in `db->image`;
+//    write `db->image` to the file.
+
+static int image_store(ftx_db* db, size_t i, long balance) {
+    char buf[ftx_db::max_asize];
+    auto [ptr, len] = ftx_acct::unparse(buf, sizeof(buf), *db, balance);
+    if (len == 0) {
+        return -1;
+    }
+    memcpy(&db->image[i * db->asize + db->balance_offset], ptr, len);
+    return 0;
+}
+
+static int image_write(ftx_db* db) {
+    size_t sz = db->naccounts * db->asize;
+    if (io61_pwrite(db->f, db->image.get(), sz, db->data_offset)
+        != ssize_t(sz)) {
+        return -1;
+    }
+    return io61_flush(db->f);
+}
+
+
+// ftx_db::checkpoint()
+//    In mmap mode, write the mapping back to the file with `msync`.
+//    In WAL mode, see `wal_checkpoint`. In memory mode, write all
+//    balances to the file. Each balance is read under its account’s
+//    lock, but a transfer may run between two reads, so the file is a
+//    consistent snapshot only when no transfers are in progress (for
+//    instance, at close). Returns 0 on success, -1 on error.
+
+static int wal_checkpoint(ftx_wal* wal);
+
+int ftx_db::checkpoint() {
+    assert(this->mem || this->mapped);
+    std::unique_lock guard(this->checkpoint_m);
+    if (this->mapped) {
+        return msync(this->mapped, this->mapped_size, MS_SYNC);
+    } else if (this->wal) {
+        return wal_checkpoint(this->wal);
+    }
+    int r = 0;
+    for (size_t i = 0; i != this->naccounts && r == 0; ++i) {
+        this->mem[i].m.lock();
+        long balance = this->mem[i].balance;
+        this->mem[i].m.unlock();
+        r = image_store(this, i, balance);
+    }
+    if (r == 0) {
+        r = image_write(this);
+    }
+    return r;
+}
+
+
+
+// WRITE-AHEAD LOG
+//    In WAL mode (`-m wal`), balances live in memory as in memory mode,
+//    and each transfer appends a redo record, holding every balance it
+//    wrote, to a log next to the account file (FILE.wal). The record is
+//    appended when the transfer releases its first lock, while it still
+//    holds the others, so the log orders transfers the same way the locks
+//    did. A transfer whose record is lost is lost entirely: no money is
+//    created or destroyed.
+//
+//    A flusher thread writes appended records in groups. With `-S`, it
+//    syncs each group, and transfers wait for their records to be durable
+//    after releasing their locks. Every `checkpoint_every` bytes of log,
+//    the flusher checkpoints: it writes FILE from `committed`, the
+//    balances as of the last appended record, and then empties the log.
+//    `ftx_db::open_args` replays whatever log remains.
+//
+//    Log format: an `ftx_wal_header`, then records. Each record is an
+//    `ftx_wal_record` followed by `nentries` `ftx_wal_entry`s. Replay
+//    stops at the first record that is short or fails its checksum.
+//
+//    LSNs (log sequence numbers) count bytes appended since the log was
+//    opened; they keep growing when checkpoints empty the log. The record
+//    at LSN `lsn` is at file offset `lsn - base_lsn`.
+
+struct ftx_wal_header {
+    char magic[8];
+    uint64_t checkpoint_lsn;    // offset where replay starts
+};
+
+struct ftx_wal_record {
+    uint32_t nentries;
+    uint32_t checksum;          // of the entries
+};
+
+struct ftx_wal_entry {
+    uint64_t aindex;
+    int64_t balance;
+};
+
+static constexpr char ftx_wal_magic[8] = {'F', 'T', 'X', 'W', 'A', 'L', '1', 0};
+
+struct ftx_wal {
+    ftx_db* db;
+    int fd;
+    bool sync;                  // sync each group?
+    std::mutex write_m;         // serializes writes to the log file
+    std::mutex m;               // protects the fields below
+    std::condition_variable cv; // wakes the flusher
+    std::condition_variable durable_cv;  // wakes waiting transfers
+    std::vector<char> buf;      // appended records not yet written
+    std::vector<long> committed;         // balances as of `end_lsn`
+    uint64_t end_lsn;           // LSN after last appended record
+    uint64_t written_lsn;       // LSN after last written record
+    uint64_t base_lsn = 0;      // LSN minus file offset
+    uint64_t checkpoint_lsn;    // `end_lsn` at last checkpoint
+    uint64_t checkpoint_every = 4 << 20;
+    bool done = false;
+    std::thread flusher;
+};
+
+// Per-thread transfer state
+static thread_local std::vector<ftx_wal_entry> wal_pending;
+static thread_local int wal_nlocked;
+static thread_local uint64_t wal_commit_lsn;
+
+
+static uint32_t wal_checksum(const ftx_wal_entry* e, size_t n) {
+    // FNV-1a
+    uint32_t h = 2166136261U;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(e);
+    for (size_t i = 0; i != n * sizeof(ftx_wal_entry); ++i) {
+        h = (h ^ p[i]) * 16777619U;
+    }
+    return h;
+}
+
+static int wal_pwrite(int fd, const void* buf, size_t sz, uint64_t off) {
+    const char* p = reinterpret_cast<const char*>(buf);
+    size_t nw = 0;
+    while (nw != sz) {
+        ssize_t r = pwrite(fd, p + nw, sz - nw, off + nw);
+        if (r == -1 && errno != EINTR) {
+            return -1;
+        } else if (r > 0) {
+            nw += r;
+        }
+    }
+    return 0;
+}
+
+
+// wal_write_group(wal, group, lsn, sync)
+//    Write `group`, the appended records that end at LSN `lsn`, to the
+//    log, and sync it if `sync`. Then wake transfers waiting for those
+//    records. The caller must hold `wal->write_m`.
+
+static int wal_write_group(ftx_wal* wal, const std::vector<char>& group,
+                           uint64_t lsn, bool sync) {
+    uint64_t off = lsn - group.size() - wal->base_lsn;
+    if (wal_pwrite(wal->fd, group.data(), group.size(), off) == -1
+        || (sync && fdatasync(wal->fd) == -1)) {
+        return -1;
+    }
+    std::unique_lock guard(wal->m);
+    wal->written_lsn = lsn;
+    wal->durable_cv.notify_all();
+    return 0;
+}
+
+
+// wal_flusher(wal)
+//    Body of the flusher thread.
+
+static void wal_flusher(ftx_wal* wal) {
+    std::vector<char> group;
+    while (true) {
+        {
+            std::unique_lock guard(wal->m);
+            while (wal->buf.empty() && !wal->done) {
+                wal->cv.wait(guard);
+            }
+            if (wal->buf.empty()) {
+                return;
+            }
+        }
+
+        // A checkpoint may have written the records meanwhile
+        std::unique_lock wguard(wal->write_m);
+        std::unique_lock guard(wal->m);
+        group.clear();
+        group.swap(wal->buf);
+        uint64_t lsn = wal->end_lsn;
+        bool checkpoint = lsn - wal->checkpoint_lsn >= wal->checkpoint_every;
+        guard.unlock();
+        if (!group.empty()) {
+            int r = wal_write_group(wal, group, lsn, wal->sync);
+            assert(r == 0);
+        }
+        wguard.unlock();
+
+        if (checkpoint) {
+            int r = wal->db->checkpoint();
+            assert(r == 0);
+        }
+    }
+}
+
+
+// ftx_db::wal_open(fname, fresh, sync)
+//    Enter WAL mode using log file `fname`, after `load`. Replays the log
+//    unless `fresh` is true, in which case the account file is new and
+//    any old log is discarded. Returns 0 on success, -1 on error.
+
+int ftx_db::wal_open(const char* fname, bool fresh, bool sync) {
+    assert(this->mem && !this->wal);
+    int fd = open(fname, O_RDWR | O_CREAT | (fresh ? O_TRUNC : 0), 0666);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // Read the whole log
+    std::vector<char> log;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    log.resize(st.st_size);
+    size_t nread = 0;
+    while (nread != log.size()) {
+        ssize_t nr = pread(fd, &log[nread], log.size() - nread, nread);
+        if (nr == 0) {
+            log.resize(nread);
+        } else if (nr == -1 && errno != EINTR) {
+            close(fd);
+            return -1;
+        } else if (nr > 0) {
+            nread += nr;
+        }
+    }
+
+    // Check or create header
+    ftx_wal_header h;
+    if (log.size() < sizeof(h)) {
+        memcpy(h.magic, ftx_wal_magic, sizeof(h.magic));
+        h.checkpoint_lsn = sizeof(h);
+        if (ftruncate(fd, 0) == -1
+            || wal_pwrite(fd, &h, sizeof(h), 0) == -1) {
+            close(fd);
+            return -1;
+        }
+        log.assign(reinterpret_cast<char*>(&h),
+                   reinterpret_cast<char*>(&h) + sizeof(h));
+    } else {
+        memcpy(&h, log.data(), sizeof(h));
+        if (memcmp(h.magic, ftx_wal_magic, sizeof(h.magic)) != 0
+            || h.checkpoint_lsn < sizeof(h)
+            || h.checkpoint_lsn > log.size()) {
+            close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    // Replay records after the checkpoint
+    uint64_t lsn = h.checkpoint_lsn;
+    while (log.size() - lsn >= sizeof(ftx_wal_record)) {
+        ftx_wal_record rec;
+        memcpy(&rec, &log[lsn], sizeof(rec));
+        size_t esz = size_t(rec.nentries) * sizeof(ftx_wal_entry);
+        if (log.size() - lsn - sizeof(rec) < esz) {
+            break;
+        }
+        std::vector<ftx_wal_entry> entries(rec.nentries);
+        memcpy(entries.data(), &log[lsn + sizeof(rec)], esz);
+        if (wal_checksum(entries.data(), rec.nentries) != rec.checksum) {
+            break;
+        }
+        for (auto& e : entries) {
+            if (e.aindex < this->naccounts) {
+                this->mem[e.aindex].balance = e.balance;
+            }
+        }
+        lsn += sizeof(rec) + esz;
+    }
+    // Drop any torn record at the end
+    if (lsn != log.size() && ftruncate(fd, lsn) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    ftx_wal* w = new ftx_wal;
+    w->db = this;
+    w->fd = fd;
+    w->sync = sync;
+    w->committed.resize(this->naccounts);
+    for (size_t i = 0; i != this->naccounts; ++i) {
+        w->committed[i] = this->mem[i].balance;
+    }
+    w->end_lsn = w->written_lsn = lsn;
+    w->checkpoint_lsn = h.checkpoint_lsn;
+    w->flusher = std::thread(wal_flusher, w);
+    this->wal = w;
+    return 0;
+}
+
+
+// wal_close(wal)
+//    Drain the log, checkpoint (which empties the log), and close.
+
+static void wal_close(ftx_wal* wal) {
+    {
+        std::unique_lock guard(wal->m);
+        wal->done = true;
+        wal->cv.notify_all();
+    }
+    wal->flusher.join();
+    int r = wal->db->checkpoint();
+    assert(r == 0);
+    close(wal->fd);
+    wal->db->wal = nullptr;
+    delete wal;
+}
+
+
+// wal_checkpoint(wal)
+//    Write the balances as of the last appended record to the account
+//    file, then empty the log. The snapshot comes from `committed`,
+//    which `wal_commit` updates together with the log, so it is
+//    consistent even while transfers run. The log is made durable
+//    through the snapshot before the account file is written, and the
+//    account file before the log is emptied. A crash between the two
+//    replays records the snapshot already reflects, which is harmless
+//    because records hold new balances, not differences. Called with
+//    `checkpoint_m` held.
+
+static int wal_checkpoint(ftx_wal* wal) {
+    ftx_db* db = wal->db;
+    std::unique_lock wguard(wal->write_m);
+    std::unique_lock guard(wal->m);
+    std::vector<long> snapshot = wal->committed;
+    std::vector<char> group;
+    group.swap(wal->buf);
+    uint64_t lsn = wal->end_lsn;
+    guard.unlock();
+
+    // Force the log through the snapshot
+    if (wal_write_group(wal, group, lsn, true) == -1) {
+        return -1;
+    }
+
+    // Write and sync the account file
+    for (size_t i = 0; i != db->naccounts; ++i) {
+        if (image_store(db, i, snapshot[i]) == -1) {
+            return -1;
+        }
+    }
+    if (image_write(db) == -1 || fdatasync(io61_fileno(db->f)) == -1) {
+        return -1;
+    }
+
+    // Empty the log; later records go right after the header
+    if (ftruncate(wal->fd, sizeof(ftx_wal_header)) == -1
+        || fdatasync(wal->fd) == -1) {
+        return -1;
+    }
+    guard.lock();
+    wal->base_lsn = lsn - sizeof(ftx_wal_header);
+    wal->checkpoint_lsn = lsn;
+    return 0;
+}
+
+
+// ftx_db::wal_locked(), wal_write(aindex, balance), wal_commit(),
+//    wal_unlocked()
+//    Called by `ftx_acct` in WAL mode. Writes are collected per thread;
+//    `wal_commit` logs them as one record when the thread first releases
+//    a lock; once the thread holds no locks, `wal_unlocked` waits for
+//    the record to become durable if syncing.
+
+void ftx_db::wal_locked() const {
+    ++wal_nlocked;
+}
+
+void ftx_db::wal_write(size_t aindex, long balance) const {
+    for (auto& e : wal_pending) {
+        if (e.aindex == aindex) {
+            e.balance = balance;
+            return;
+        }
+    }
+    wal_pending.push_back({aindex, balance});
+}
+
+void ftx_db::wal_commit() const {
+    if (wal_pending.empty()) {
+        return;
+    }
+    ftx_wal_record rec;
+    rec.nentries = wal_pending.size();
+    rec.checksum = wal_checksum(wal_pending.data(), wal_pending.size());
+    const char* rp = reinterpret_cast<const char*>(&rec);
+    const char* ep = reinterpret_cast<const char*>(wal_pending.data());
+    size_t esz = wal_pending.size() * sizeof(ftx_wal_entry);
+
+    std::unique_lock guard(this->wal->m);
+    bool was_empty = this->wal->buf.empty();
+    this->wal->buf.insert(this->wal->buf.end(), rp, rp + sizeof(rec));
+    this->wal->buf.insert(this->wal->buf.end(), ep, ep + esz);
+    for (auto& e : wal_pending) {
+        this->wal->committed[e.aindex] = e.balance;
+    }
+    this->wal->end_lsn += sizeof(rec) + esz;
+    wal_commit_lsn = this->wal->end_lsn;
+    if (was_empty) {
+        this->wal->cv.notify_one();
+    }
+    guard.unlock();
+    wal_pending.clear();
+}
+
+void ftx_db::wal_unlocked() const {
+    assert(wal_nlocked > 0);
+    --wal_nlocked;
+    if (wal_nlocked == 0 && wal_commit_lsn != 0 && this->wal->sync) {
+        std::unique_lock guard(this->wal->m);
+        while (this->wal->written_lsn < wal_commit_lsn) {
+            this->wal->durable_cv.wait(guard);
+        }
+    }
+    if (wal_nlocked == 0) {
+        wal_commit_lsn = 0;
+    }
+}
+
+
 ftx_db* ftx_db::open_args(const io61_args& args) {
     const char* original = args.input_file;
     if (original == nullptr) {
         original = "accounts.fdb";
     }
+    const char* mode = args.db_mode ? args.db_mode : "file";
+    bool memory = strcmp(mode, "memory") == 0;
+    bool optimistic = strcmp(mode, "optimistic") == 0;
+    bool wal = strcmp(mode, "wal") == 0;
+    bool mapped = strcmp(mode, "mmap") == 0;
+    if (!memory && !optimistic && !wal && !mapped
+        && strcmp(mode, "file") != 0) {
+        fprintf(stderr, "%s: unknown database mode\n", mode);
+        exit(1);
+    }
     const char* copy = nullptr;
     if (args.modify) {
         copy = original;
@@ -48,7 +598,27 @@ ftx_db* ftx_db::open_args(const io61_args& args) {
         assert(r == 0);
     }
     io61_file* f = io61_open_check(copy, O_RDWR);
-    return new ftx_db(f);
+    ftx_db* db = new ftx_db(f);
+    if (memory || optimistic || wal) {
+        db->optimistic = optimistic;
+        if (db->load() == -1) {
+            fprintf(stderr, "%s: %s\n", copy, strerror(errno));
+            exit(1);
+        }
+    }
+    if (mapped && db->map() == -1) {
+        fprintf(stderr, "%s: %s\n", copy, strerror(errno));
+        exit(1);
+    }
+    if (wal) {
+        std::string walname = std::string(copy) + ".wal";
+        if (db->wal_open(walname.c_str(), strcmp(original, copy) != 0,
+                         args.sync) == -1) {
+            fprintf(stderr, "%s: %s\n", walname.c_str(), strerror(errno));
+            exit(1);
+        }
+    }
+    return db;
 }
 
 
@@ -59,6 +629,22 @@ int ftx_acct::parse(const char* buf, size_t len, const ftx_db& db,
         return -1;
     }
 
+    // Binary records need only copying
+    if (db.binary) {
+        ftx_bin_acct rec;
+        memcpy(&rec, buf, sizeof(rec));
+        if (namebuf && namesz > 0) {
+            size_t n = std::min(strnlen(rec.name, sizeof(rec.name)),
+                                namesz - 1);
+            memcpy(namebuf, rec.name, n);
+            namebuf[n] = '\0';
+        }
+        if (balance) {
+            *balance = rec.balance;
+        }
+        return 0;
+    }
+
     // Store name, if requested
     if (namebuf && namesz > 0) {
         size_t off = 0;
@@ -94,6 +680,12 @@ int ftx_acct::parse(const char* buf, size_t len, const ftx_db& db,
 
 std::pair<const char*, size_t> ftx_acct::unparse(char* buf, size_t len,
         const ftx_db& db, long balance) {
+    if (db.binary) {
+        int64_t b = balance;
+        assert(len >= sizeof(b));
+        memcpy(buf, &b, sizeof(b));
+        return std::make_pair(buf, sizeof(b));
+    }
     assert(len >= db.balance_size * 2 + 1);
     size_t off = db.balance_size;
     size_t lastoff = off + db.balance_size;
@@ -2,10 +2,16 @@
 #include <sys/resource.h>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 
-// Usage: ./ftxrocket [-j NTHREADS] [-n NOPS] [FILE]
+// Usage: ./ftxrocket [-b BLOCKSIZE] [-m MODE] [-M] [-H] [-S] [-j NTHREADS] [-n NOPS] [FILE]
 //    Perform NOPS * NTHREADS “bank transfers” within FILE, completely
 //    legally.
+//
+//    With `-H`, distinguished threads combine their transfers among the
+//    three hot accounts: one thread at a time applies everyone’s pending
+//    transfers as a batch, paying the network delay once per batch.
 
 static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
                             unsigned seed) {
@@ -24,9 +30,19 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
             continue;
         }
 
-        // Lock both accounts; prevent deadlock with lock ordering
         ftx_acct acct1{db, aindex[0]};
         ftx_acct acct2{db, aindex[1]};
+
+        // In optimistic mode, transfer without locks, retrying if another
+        // thread commits to either account first
+        if (db.optimistic) {
+            ftx_optimistic_transfer(acct1, acct2,
+                                    (long) pick_amount(randomness));
+            ++i;
+            continue;
+        }
+
+        // Lock both accounts; prevent deadlock with lock ordering
         std::unique_lock guard1{aindex[0] < aindex[1] ? acct1 : acct2};
         std::unique_lock guard2{aindex[0] < aindex[1] ? acct2 : acct1};
 
@@ -35,14 +51,9 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
         acct1.read(nullptr, 0, &bal[0]);
         acct2.read(nullptr, 0, &bal[1]);
 
-        // Model network delay or heavy computation
-        usleep(1);
-
-        // Compute amount to transfer
-        long delta = std::min(bal[0], (long) pick_amount(randomness));
-        delta = std::min(delta, 9999999 - bal[1]);
-        bal[0] -= delta;
-        bal[1] += delta;
+        // Model network delay or heavy computation, then compute the
+        // amount to transfer
+        ftx_compute_transfer(bal, (long) pick_amount(randomness));
 
         // Update balances
         acct1.write(bal[0]);
@@ -54,6 +65,88 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
 }
 
 
+// Flat combining for transfers among the hot accounts 0–2
+struct hot_transfer {
+    size_t from;
+    size_t to;
+    long amount;              // requested amount
+    bool done = false;
+};
+
+struct hot_combiner {
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<hot_transfer*> pending;
+    bool busy = false;        // is some thread combining?
+    size_t nthreads = 0;      // number of threads still combining
+};
+
+static constexpr size_t nhot = 3;
+static hot_combiner* hotc;    // non-null with `-H`
+
+
+// hot_apply(db, batch)
+//    Apply a batch of hot transfers, in order, under the locks of all hot
+//    accounts. Each transfer is limited exactly as an ordinary one is.
+
+static void hot_apply(ftx_db& db, const std::vector<hot_transfer*>& batch) {
+    ftx_acct accts[nhot] = {{db, 0}, {db, 1}, {db, 2}};
+    long bal[nhot];
+    for (size_t a = 0; a != nhot; ++a) {
+        accts[a].lock();
+        accts[a].read(nullptr, 0, &bal[a]);
+    }
+
+    // Model network delay or heavy computation, once per batch
+    usleep(1);
+
+    for (hot_transfer* t : batch) {
+        ftx_move_balance(bal[t->from], bal[t->to], t->amount);
+    }
+    for (size_t a = 0; a != nhot; ++a) {
+        accts[a].write(bal[a]);
+    }
+    for (size_t a = 0; a != nhot; ++a) {
+        accts[a].unlock();
+    }
+}
+
+
+// hot_submit(db, hc, t)
+//    Perform hot transfer `t`. If no thread is combining, this thread
+//    becomes the combiner and applies every pending transfer; otherwise
+//    it waits for a combiner to apply `t`.
+
+static void hot_submit(ftx_db& db, hot_combiner& hc, hot_transfer& t) {
+    std::unique_lock guard(hc.m);
+    hc.pending.push_back(&t);
+    hc.cv.notify_all();
+    while (!t.done) {
+        if (hc.busy) {
+            hc.cv.wait(guard);
+            continue;
+        }
+        hc.busy = true;
+        // Give the other combining threads a moment to join the batch
+        auto deadline = std::chrono::steady_clock::now()
+            + std::chrono::microseconds(50);
+        while (hc.pending.size() < hc.nthreads
+               && hc.cv.wait_until(guard, deadline) != std::cv_status::timeout) {
+        }
+        std::vector<hot_transfer*> batch;
+        batch.swap(hc.pending);
+        guard.unlock();
+        hot_apply(db, batch);
+        guard.lock();
+        for (hot_transfer* bt : batch) {
+            bt->done = true;
+        }
+        hc.busy = false;
+        hc.cv.notify_all();
+    }
+}
+
+
 static void sbf_transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
                                 unsigned seed) {
     // Obtain a source of random account numbers
@@ -75,15 +168,33 @@ static void sbf_transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
             do {
                 aindex[1] = pick_sbf_account(randomness);
             } while (aindex[1] == aindex[0]);
+
+            if (hotc) {
+                hot_transfer t{aindex[0], aindex[1],
+                               (long) pick_amount(randomness)};
+                hot_submit(db, *hotc, t);
+                ++i;
+                continue;
+            }
         } else {
             // 10% of the time, “borrow” some customer money
             aindex[0] = pick_customer_account(randomness);
             aindex[1] = pick_sbf_account(randomness);
         }
 
-        // Lock both accounts; prevent deadlock with lock ordering
         ftx_acct acct1{db, aindex[0]};
         ftx_acct acct2{db, aindex[1]};
+
+        // In optimistic mode, transfer without locks, retrying if another
+        // thread commits to either account first
+        if (db.optimistic) {
+            ftx_optimistic_transfer(acct1, acct2,
+                                    (long) pick_amount(randomness));
+            ++i;
+            continue;
+        }
+
+        // Lock both accounts; prevent deadlock with lock ordering
         std::unique_lock guard1{aindex[0] < aindex[1] ? acct1 : acct2};
         std::unique_lock guard2{aindex[0] < aindex[1] ? acct2 : acct1};
 
@@ -92,14 +203,9 @@ static void sbf_transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
         acct1.read(nullptr, 0, &bal[0]);
         acct2.read(nullptr, 0, &bal[1]);
 
-        // Model network delay or heavy computation
-        usleep(1);
-
-        // Compute amount to transfer
-        long delta = std::min(bal[0], (long) pick_amount(randomness));
-        delta = std::min(delta, 9999999 - bal[1]);
-        bal[0] -= delta;
-        bal[1] += delta;
+        // Model network delay or heavy computation, then compute the
+        // amount to transfer
+        ftx_compute_transfer(bal, (long) pick_amount(randomness));
 
         // Update balances
         acct1.write(bal[0]);
@@ -108,12 +214,19 @@ static void sbf_transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
         ++i;
     }
     opcount = i;
+
+    if (hotc) {
+        // Stop combiners from waiting for this thread
+        std::unique_lock guard(hotc->m);
+        --hotc->nthreads;
+        hotc->cv.notify_all();
+    }
 }
 
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_args args = io61_args("i:D:j:J:n:").set_nthreads(4)
+    io61_args args = io61_args("b:i:D:j:J:n:m:HSM").set_nthreads(4)
         .set_noperations(100'000)
         .set_ndistinguished_threads(1)
         .parse(argc, argv);
@@ -121,6 +234,16 @@ int main(int argc, char* argv[]) {
     // Allocate buffer, open files
     ftx_db* db = ftx_db::open_args(args);
     args.after_open(db->f, O_RDWR);
+    if (args.combine && db->optimistic) {
+        fprintf(stderr, "-H does not support optimistic mode\n");
+        exit(1);
+    }
+    assert(db->naccounts > nhot);
+    hot_combiner hc;
+    hc.nthreads = args.ndistinguished_threads;
+    if (args.combine) {
+        hotc = &hc;
+    }
     std::random_device seed_randomness;
     double start_time = monotonic_timestamp();
 
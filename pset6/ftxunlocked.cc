@@ -3,7 +3,7 @@
 #include <thread>
 #include <mutex>
 
-// Usage: ./ftxunlocked [-j NTHREADS] [-n NOPS] [FILE]
+// Usage: ./ftxunlocked [-b BLOCKSIZE] [-m MODE] [-M] [-j NTHREADS] [-n NOPS] [FILE]
 //    Perform NOPS * NTHREADS “bank transfers” within FILE.
 //    This versiond oes not acquire file locks, and thus cannot be made
 //    correct.
@@ -55,7 +55,7 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_args args = io61_args("i:D:j:n:").set_nthreads(4)
+    io61_args args = io61_args("b:i:D:j:n:m:M").set_nthreads(4)
         .set_noperations(100'000)
         .parse(argc, argv);
 
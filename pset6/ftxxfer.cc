@@ -3,7 +3,7 @@
 #include <thread>
 #include <mutex>
 
-// Usage: ./ftxxfer [-j NTHREADS] [-n NOPS] [FILE]
+// Usage: ./ftxxfer [-b BLOCKSIZE] [-m MODE] [-M] [-S] [-j NTHREADS] [-n NOPS] [FILE]
 //    Perform NOPS * NTHREADS “bank transfers” within FILE.
 
 static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
@@ -23,9 +23,19 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
             continue;
         }
 
-        // Lock both accounts; prevent deadlock with lock ordering
         ftx_acct acct1{db, aindex[0]};
         ftx_acct acct2{db, aindex[1]};
+
+        // In optimistic mode, transfer without locks, retrying if another
+        // thread commits to either account first
+        if (db.optimistic) {
+            ftx_optimistic_transfer(acct1, acct2,
+                                    (long) pick_amount(randomness));
+            ++i;
+            continue;
+        }
+
+        // Lock both accounts; prevent deadlock with lock ordering
         std::unique_lock guard1{aindex[0] < aindex[1] ? acct1 : acct2};
         std::unique_lock guard2{aindex[0] < aindex[1] ? acct2 : acct1};
 
@@ -34,14 +44,9 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
         acct1.read(nullptr, 0, &bal[0]);
         acct2.read(nullptr, 0, &bal[1]);
 
-        // Model network delay or heavy computation
-        usleep(1);
-
-        // Compute amount to transfer
-        long delta = std::min(bal[0], (long) pick_amount(randomness));
-        delta = std::min(delta, 9999999 - bal[1]);
-        bal[0] -= delta;
-        bal[1] += delta;
+        // Model network delay or heavy computation, then compute the
+        // amount to transfer
+        ftx_compute_transfer(bal, (long) pick_amount(randomness));
 
         // Update balances
         acct1.write(bal[0]);
@@ -55,7 +60,7 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_args args = io61_args("i:D:j:n:").set_nthreads(4)
+    io61_args args = io61_args("b:i:D:j:n:m:SM").set_nthreads(4)
         .set_noperations(100'000)
         .parse(argc, argv);
 
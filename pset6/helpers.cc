@@ -207,6 +207,15 @@ io61_args& io61_args::parse(int argc, char** argv) {
                 goto usage;
             }
             break;
+        case 'm':
+            this->db_mode = optarg;
+            break;
+        case 'H':
+            this->combine = true;
+            break;
+        case 'S':
+            this->sync = true;
+            break;
         case '#':
         default:
             goto usage;
@@ -313,12 +322,21 @@ void io61_args::usage() {
     if (strchr(this->opts, 'J')) {
         fprintf(stderr, "    -J N          Use N distinguished threads\n");
     }
+    if (strchr(this->opts, 'H')) {
+        fprintf(stderr, "    -H            Combine hot-account transfers\n");
+    }
+    if (strchr(this->opts, 'S')) {
+        fprintf(stderr, "    -S            Sync ledger and log to disk after each group\n");
+    }
     if (strchr(this->opts, 'n')) {
         fprintf(stderr, "    -n N          Perform N operations\n");
     }
     if (strchr(this->opts, 'M')) {
         fprintf(stderr, "    -M            Modify input file in place\n");
     }
+    if (strchr(this->opts, 'm')) {
+        fprintf(stderr, "    -m MODE       Set database mode (file, memory, optimistic, wal, mmap)\n");
+    }
 }
 
 void io61_args::after_open() {
@@ -349,6 +367,14 @@ void io61_args::after_open(int fd, int mode) {
 }
 
 void io61_args::after_open(io61_file* f, int mode) {
+    if (this->block_size > 0 && (mode & O_ACCMODE) == O_RDWR) {
+        int r = io61_set_block_size(f, this->block_size);
+        if (r != 0) {
+            fprintf(stderr, "%s: bad block size %zu\n",
+                    this->program_name, this->block_size);
+            exit(1);
+        }
+    }
     this->after_open(io61_fileno(f), mode);
 }
 
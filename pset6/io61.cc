@@ -1,9 +1,15 @@
 #include "io61.hh"
 #include <climits>
 #include <cerrno>
+#include <atomic>
 #include <mutex>
 #include <shared_mutex>
 #include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -11,6 +17,41 @@
 //    YOUR CODE HERE!
 
 
+// io61_range_lock, io61_lock_waiter
+//    A granted byte-range lock, and a thread blocked in `io61_lock`.
+//    Each waiter sleeps on its own condition variable, so `io61_unlock`
+//    wakes only the threads whose ranges it released.
+
+struct io61_range_lock {
+    off_t end;               // offset one past last locked byte
+    int locktype;            // LOCK_SH or LOCK_EX
+    std::thread::id owner;   // thread holding the lock
+};
+
+struct io61_lock_waiter {
+    off_t start;
+    off_t end;
+    int locktype;
+    std::thread::id owner;
+    std::condition_variable cv;
+};
+
+
+// io61_pblock
+//    One block of the positioned-mode cache. Threads hold `latch` shared
+//    to copy out of a loaded block, and exclusive to load, modify, or
+//    flush it, so threads using different blocks never wait on each other.
+//    Buffers are allocated on first use.
+
+struct io61_pblock {
+    std::shared_mutex latch;
+    off_t tag = -1;      // offset of first character in `buf`; -1 if empty
+    off_t end_tag = -1;  // offset one past last valid character in `buf`
+    bool dirty = false;  // has block been written?
+    std::unique_ptr<unsigned char[]> buf;
+};
+
+
 // io61_file
 //    Data structure for io61 file wrappers.
 
@@ -26,9 +67,21 @@ struct io61_file {
     off_t pos_tag;   // next offset to read or write (non-positioned mode)
     off_t end_tag;   // offset one past last valid character in `cbuf`
 
-    // Positioned mode
     bool dirty = false;       // has cache been written?
-    bool positioned = false;  // is cache in positioned mode?
+    std::mutex stream_m;      // serializes stream (non-positioned) calls
+
+    // Positioned mode: a direct-mapped cache of `npblocks` blocks
+    static constexpr size_t npblocks = 64;
+    static constexpr off_t max_pblocksz = 1 << 20;
+    io61_pblock pblocks[npblocks];
+    off_t pblocksz = 8192;    // block size; see `io61_set_block_size`
+    std::atomic<bool> positioned = false;  // are blocks in use?
+
+    // Range locks
+    std::mutex lock_m;        // protects the fields below
+    std::multimap<off_t, io61_range_lock> locks;  // granted, by start
+    off_t lock_maxlen = 0;    // length of longest lock ever granted
+    std::list<io61_lock_waiter*> lock_waiters;
 };
 
 
@@ -74,8 +127,10 @@ int io61_close(io61_file* f) {
 //    which equals -1, on end of file or error.
 
 static int io61_fill(io61_file* f);
+static int io61_flush_stream(io61_file* f);
 
 int io61_readc(io61_file* f) {
+    std::unique_lock guard(f->stream_m);
     assert(!f->positioned);
     if (f->pos_tag == f->end_tag) {
         io61_fill(f);
@@ -100,6 +155,7 @@ int io61_readc(io61_file* f) {
 //    This is called a “short read.”
 
 ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
+    std::unique_lock guard(f->stream_m);
     assert(!f->positioned);
     size_t nread = 0;
     while (nread != sz) {
@@ -126,9 +182,10 @@ ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
 //    Returns 0 on success and -1 on error.
 
 int io61_writec(io61_file* f, int c) {
+    std::unique_lock guard(f->stream_m);
     assert(!f->positioned);
     if (f->pos_tag == f->tag + f->cbufsz) {
-        int r = io61_flush(f);
+        int r = io61_flush_stream(f);
         if (r == -1) {
             return -1;
         }
@@ -147,13 +204,17 @@ int io61_writec(io61_file* f, int c) {
 //    a drive running out of space. In this case io61_write returns the
 //    number of characters written, or -1 if no characters were written
 //    before the error occurred.
+//
+//    Stream calls are serialized by `f->stream_m`, so threads may share a
+//    stream; each io61_write's characters stay contiguous in the file.
 
 ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
+    std::unique_lock guard(f->stream_m);
     assert(!f->positioned);
     size_t nwritten = 0;
     while (nwritten != sz) {
         if (f->end_tag == f->tag + f->cbufsz) {
-            int r = io61_flush(f);
+            int r = io61_flush_stream(f);
             if (r == -1 && nwritten == 0) {
                 return -1;
             } else if (r == -1) {
@@ -181,12 +242,18 @@ ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
 //    data cached for reading and seeks to the logical file position.
 
 static int io61_flush_dirty(io61_file* f);
-static int io61_flush_dirty_positioned(io61_file* f);
+static int io61_flush_positioned(io61_file* f);
 static int io61_flush_clean(io61_file* f);
 
 int io61_flush(io61_file* f) {
-    if (f->dirty && f->positioned) {
-        return io61_flush_dirty_positioned(f);
+    std::unique_lock guard(f->stream_m);
+    return io61_flush_stream(f);
+}
+
+static int io61_flush_stream(io61_file* f) {
+    // Called with `f->stream_m` locked.
+    if (f->positioned) {
+        return io61_flush_positioned(f);
     } else if (f->dirty) {
         return io61_flush_dirty(f);
     } else {
@@ -200,7 +267,8 @@ int io61_flush(io61_file* f) {
 //    Returns 0 on success and -1 on failure.
 
 int io61_seek(io61_file* f, off_t off) {
-    int r = io61_flush(f);
+    std::unique_lock stream_guard(f->stream_m);
+    int r = io61_flush_stream(f);
     if (r == -1) {
         return -1;
     }
@@ -209,7 +277,14 @@ int io61_seek(io61_file* f, off_t off) {
         return -1;
     }
     f->tag = f->pos_tag = f->end_tag = off;
-    f->positioned = false;
+    if (f->positioned) {
+        // Later stream writes would make cached blocks stale
+        for (io61_pblock& b : f->pblocks) {
+            std::unique_lock guard(b.latch);
+            b.tag = b.end_tag = -1;
+        }
+        f->positioned = false;
+    }
     return 0;
 }
 
@@ -257,21 +332,19 @@ static int io61_flush_dirty(io61_file* f) {
     return 0;
 }
 
-static int io61_flush_dirty_positioned(io61_file* f) {
-    // Called when `f`’s cache is dirty and positioned.
-    // Uses `pwrite`; does not change file position.
-    off_t flush_tag = f->tag;
-    while (flush_tag != f->end_tag) {
-        ssize_t nw = pwrite(f->fd, &f->cbuf[flush_tag - f->tag],
-                            f->end_tag - flush_tag, flush_tag);
-        if (nw >= 0) {
-            flush_tag += nw;
-        } else if (errno != EINTR && errno != EINVAL) {
-            return -1;
+static int io61_pflush_block(io61_file* f, io61_pblock& b);
+
+static int io61_flush_positioned(io61_file* f) {
+    // Called when `f` is in positioned mode.
+    // Writes every dirty block; does not change file position.
+    int r = 0;
+    for (io61_pblock& b : f->pblocks) {
+        std::unique_lock guard(b.latch);
+        if (b.dirty && io61_pflush_block(f, b) == -1) {
+            r = -1;
         }
     }
-    f->dirty = false;
-    return 0;
+    return r;
 }
 
 static int io61_flush_clean(io61_file* f) {
@@ -288,6 +361,42 @@ static int io61_flush_clean(io61_file* f) {
 
 
 // POSITIONED I/O FUNCTIONS
+//    Positioned I/O is thread-safe. Each block has its own latch, and
+//    `io61_pblock_for` finds a block's slot without any shared lock.
+//    Requests that span blocks are split, one block at a time; callers
+//    that need the whole range to change atomically should lock it.
+
+// io61_pblock_for(f, off)
+//    Returns the cache slot for the block containing offset `off`.
+
+static inline io61_pblock& io61_pblock_for(io61_file* f, off_t off) {
+    return f->pblocks[(off / f->pblocksz) % io61_file::npblocks];
+}
+
+
+// io61_set_block_size(f, sz)
+//    Sets the size of `f`’s positioned-mode cache blocks, which is also
+//    their alignment. Larger blocks suit sequential scans; smaller ones
+//    suit scattered records. Flushes and drops any cached blocks, so it
+//    must not run concurrently with other operations on `f`. Returns 0
+//    on success and -1 on error.
+
+int io61_set_block_size(io61_file* f, size_t sz) {
+    if (sz == 0 || sz > size_t(io61_file::max_pblocksz)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (f->positioned && io61_flush(f) == -1) {
+        return -1;
+    }
+    for (io61_pblock& b : f->pblocks) {
+        b.tag = b.end_tag = -1;
+        b.buf.reset();
+    }
+    f->pblocksz = sz;
+    return 0;
+}
+
 
 // io61_pread(f, buf, sz, off)
 //    Read up to `sz` bytes from `f` into `buf`, starting at offset `off`.
@@ -296,19 +405,56 @@ static int io61_flush_clean(io61_file* f) {
 //    This function can only be called when `f` was opened in read/write
 //    more (O_RDWR).
 
-static int io61_pfill(io61_file* f, off_t off);
+static int io61_pfill(io61_file* f, io61_pblock& b, off_t off);
+
+static size_t io61_pcopyout(const io61_pblock& b, unsigned char* buf,
+                            size_t sz, off_t off) {
+    if (off >= b.end_tag) {
+        return 0;
+    }
+    size_t ncopy = std::min(sz, size_t(b.end_tag - off));
+    memcpy(buf, &b.buf[off - b.tag], ncopy);
+    return ncopy;
+}
+
+static ssize_t io61_pread_block(io61_file* f, unsigned char* buf, size_t sz,
+                                off_t off) {
+    off_t btag = off - off % f->pblocksz;
+    io61_pblock& b = io61_pblock_for(f, off);
+    {
+        // Fast path: block is loaded; share it with other readers
+        std::shared_lock guard(b.latch);
+        if (b.tag == btag) {
+            return io61_pcopyout(b, buf, sz, off);
+        }
+    }
+    std::unique_lock guard(b.latch);
+    if (b.tag != btag && io61_pfill(f, b, btag) == -1) {
+        return -1;
+    }
+    return io61_pcopyout(b, buf, sz, off);
+}
 
 ssize_t io61_pread(io61_file* f, unsigned char* buf, size_t sz,
                    off_t off) {
-    if (!f->positioned || off < f->tag || off >= f->end_tag) {
-        if (io61_pfill(f, off) == -1) {
+    size_t nread = 0;
+    while (nread != sz) {
+        off_t boff = off + nread;
+        size_t nleft = f->pblocksz - boff % f->pblocksz;
+        size_t want = std::min(sz - nread, nleft);
+        ssize_t nr = io61_pread_block(f, &buf[nread], want, boff);
+        if (nr == -1 && nread == 0) {
             return -1;
+        } else if (nr == -1) {
+            break;
+        }
+        nread += nr;
+        if (size_t(nr) != want) {
+            // end of file
+            break;
         }
     }
-    size_t nleft = f->end_tag - off;
-    size_t ncopy = std::min(sz, nleft);
-    memcpy(buf, &f->cbuf[off - f->tag], ncopy);
-    return ncopy;
+    return nread;
 }
 
 
@@ -319,46 +465,166 @@ ssize_t io61_pread(io61_file* f, unsigned char* buf, size_t sz,
 //    This function can only be called when `f` was opened in read/write
 //    more (O_RDWR).
 
+static ssize_t io61_pwrite_block(io61_file* f, const unsigned char* buf,
+                                 size_t sz, off_t off) {
+    off_t btag = off - off % f->pblocksz;
+    io61_pblock& b = io61_pblock_for(f, off);
+    std::unique_lock guard(b.latch);
+    if (b.tag != btag && io61_pfill(f, b, btag) == -1) {
+        return -1;
+    }
+    size_t ncopy = std::min(sz, size_t(btag + f->pblocksz - off));
+    if (off > b.end_tag) {
+        // Writing past end of file leaves a hole, which reads as zeros
+        memset(&b.buf[b.end_tag - btag], 0, off - b.end_tag);
+    }
+    memcpy(&b.buf[off - btag], buf, ncopy);
+    b.end_tag = std::max(b.end_tag, off_t(off + ncopy));
+    b.dirty = true;
+    return ncopy;
+}
+
 ssize_t io61_pwrite(io61_file* f, const unsigned char* buf, size_t sz,
                     off_t off) {
-    if (!f->positioned || off < f->tag || off >= f->end_tag) {
-        if (io61_pfill(f, off) == -1) {
+    size_t nwritten = 0;
+    while (nwritten != sz) {
+        ssize_t nw = io61_pwrite_block(f, &buf[nwritten], sz - nwritten,
+                                       off + nwritten);
+        if (nw == -1 && nwritten == 0) {
             return -1;
+        } else if (nw == -1) {
+            break;
         }
+        nwritten += nw;
     }
-    size_t nleft = f->end_tag - off;
-    size_t ncopy = std::min(sz, nleft);
-    memcpy(&f->cbuf[off - f->tag], buf, ncopy);
-    f->dirty = true;
-    return ncopy;
+    return nwritten;
 }
 
 
-// io61_pfill(f, off)
-//    Fill the single-slot cache with data including offset `off`.
-//    The handout code rounds `off` down to a multiple of 8192.
+// io61_pfill(f, b, off)
+//    Load block `b` with the data starting at block-aligned offset `off`,
+//    writing back its previous contents if dirty. Caller must hold
+//    `b.latch` exclusively.
 
-static int io61_pfill(io61_file* f, off_t off) {
+static int io61_pfill(io61_file* f, io61_pblock& b, off_t off) {
     assert(f->mode == O_RDWR);
-    if (f->dirty && io61_flush(f) == -1) {
+    assert(off % f->pblocksz == 0);
+    if (b.dirty && io61_pflush_block(f, b) == -1) {
         return -1;
     }
+    if (!b.buf) {
+        b.buf.reset(new unsigned char[f->pblocksz]);
+    }
 
-    off = off - (off % 8192);
-    ssize_t nr = pread(f->fd, f->cbuf, f->cbufsz, off);
-    if (nr == -1) {
-        return -1;
+    ssize_t nr;
+    while (true) {
+        nr = pread(f->fd, b.buf.get(), f->pblocksz, off);
+        if (nr >= 0) {
+            break;
+        } else if (errno != EINTR && errno != EAGAIN) {
+            b.tag = b.end_tag = -1;
+            return -1;
+        }
     }
-    f->tag = off;
-    f->end_tag = off + nr;
+    b.tag = off;
+    b.end_tag = off + nr;
     f->positioned = true;
     return 0;
 }
 
 
+// io61_pflush_block(f, b)
+//    Write dirty block `b` to the file. Caller must hold `b.latch`
+//    exclusively.
+
+static int io61_pflush_block(io61_file* f, io61_pblock& b) {
+    off_t flush_tag = b.tag;
+    while (flush_tag != b.end_tag) {
+        ssize_t nw = pwrite(f->fd, &b.buf[flush_tag - b.tag],
+                            b.end_tag - flush_tag, flush_tag);
+        if (nw >= 0) {
+            flush_tag += nw;
+        } else if (errno != EINTR && errno != EINVAL) {
+            return -1;
+        }
+    }
+    b.dirty = false;
+    return 0;
+}
+
+
 
 // FILE LOCKING FUNCTIONS
 
+// io61_lock_blockers(f, start, end, locktype, owner, blockers)
+//    Returns true if a lock on `[start, end)` of type `locktype`, requested
+//    by thread `owner`, conflicts with a lock granted to another thread.
+//    If `blockers` is nonnull, appends the conflicting threads to it.
+//    Exclusive locks conflict with everything; shared locks conflict
+//    only with exclusive locks. A thread never conflicts with itself.
+//    Caller must hold `f->lock_m`.
+
+static bool io61_lock_blockers(io61_file* f, off_t start, off_t end,
+                               int locktype, std::thread::id owner,
+                               std::vector<std::thread::id>* blockers) {
+    bool conflict = false;
+    // A lock starting at or before `start - lock_maxlen` ends by `start`.
+    auto it = f->locks.upper_bound(start - f->lock_maxlen);
+    for (; it != f->locks.end() && it->first < end; ++it) {
+        const io61_range_lock& l = it->second;
+        if (l.end > start
+            && l.owner != owner
+            && (locktype == LOCK_EX || l.locktype == LOCK_EX)) {
+            conflict = true;
+            if (!blockers) {
+                break;
+            }
+            blockers->push_back(l.owner);
+        }
+    }
+    return conflict;
+}
+
+
+// io61_lock_grant(f, start, end, locktype)
+//    Record a lock on `[start, end)` for the calling thread.
+//    Caller must hold `f->lock_m`.
+
+static void io61_lock_grant(io61_file* f, off_t start, off_t end,
+                            int locktype) {
+    f->locks.insert({start, {end, locktype, std::this_thread::get_id()}});
+    f->lock_maxlen = std::max(f->lock_maxlen, end - start);
+}
+
+
+// io61_lock_deadlocked(f, w)
+//    Returns true if waiter `w` would wait forever: some thread blocking
+//    `w` is itself waiting, directly or transitively, on `w`’s thread.
+//    Caller must hold `f->lock_m`.
+
+static bool io61_lock_deadlocked(io61_file* f, io61_lock_waiter* w) {
+    std::vector<std::thread::id> stack;
+    std::set<std::thread::id> seen;
+    io61_lock_blockers(f, w->start, w->end, w->locktype, w->owner, &stack);
+    while (!stack.empty()) {
+        std::thread::id t = stack.back();
+        stack.pop_back();
+        if (t == w->owner) {
+            return true;
+        } else if (!seen.insert(t).second) {
+            continue;
+        }
+        for (io61_lock_waiter* ow : f->lock_waiters) {
+            if (ow->owner == t) {
+                io61_lock_blockers(f, ow->start, ow->end, ow->locktype,
+                                   ow->owner, &stack);
+            }
+        }
+    }
+    return false;
+}
+
+
 // io61_try_lock(f, start, len, locktype)
 //    Attempts to acquire a lock on offsets `[start, len)` in file `f`.
 //    `locktype` must be `LOCK_SH`, which requests a shared lock,
@@ -368,12 +634,18 @@ static int io61_pfill(io61_file* f, off_t off) {
 //    block: if the lock cannot be acquired, it returns -1 right away.
 
 int io61_try_lock(io61_file* f, off_t start, off_t len, int locktype) {
-    (void) f;
     assert(start >= 0 && len >= 0);
     assert(locktype == LOCK_EX || locktype == LOCK_SH);
     if (len == 0) {
         return 0;
     }
+    std::unique_lock guard(f->lock_m);
+    if (io61_lock_blockers(f, start, start + len, locktype,
+                           std::this_thread::get_id(), nullptr)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    io61_lock_grant(f, start, start + len, locktype);
     return 0;
 }
 
@@ -393,10 +665,34 @@ int io61_lock(io61_file* f, off_t start, off_t len, int locktype) {
     if (len == 0) {
         return 0;
     }
-    // The handout code polls using `io61_try_lock`.
-    while (io61_try_lock(f, start, len, locktype) != 0) {
+    std::unique_lock guard(f->lock_m);
+    std::thread::id self = std::this_thread::get_id();
+    if (!io61_lock_blockers(f, start, start + len, locktype, self, nullptr)) {
+        io61_lock_grant(f, start, start + len, locktype);
+        return 0;
     }
-    return 0;
+
+    // Sleep until an unlock of an overlapping range wakes us
+    io61_lock_waiter w;
+    w.start = start;
+    w.end = start + len;
+    w.locktype = locktype;
+    w.owner = self;
+    auto wit = f->lock_waiters.insert(f->lock_waiters.end(), &w);
+    int r = 0;
+    while (io61_lock_blockers(f, w.start, w.end, locktype, self, nullptr)) {
+        if (io61_lock_deadlocked(f, &w)) {
+            errno = EDEADLK;
+            r = -1;
+            break;
+        }
+        w.cv.wait(guard);
+    }
+    f->lock_waiters.erase(wit);
+    if (r == 0) {
+        io61_lock_grant(f, w.start, w.end, locktype);
+    }
+    return r;
 }
 
 
@@ -405,11 +701,40 @@ int io61_lock(io61_file* f, off_t start, off_t len, int locktype) {
 //    Returns 0 on success and -1 on error.
 
 int io61_unlock(io61_file* f, off_t start, off_t len) {
-    (void) f;
     assert(start >= 0 && len >= 0);
     if (len == 0) {
         return 0;
     }
+    off_t end = start + len;
+    std::unique_lock guard(f->lock_m);
+    std::thread::id self = std::this_thread::get_id();
+
+    // Remove the calling thread’s locks in range, keeping any parts
+    // outside `[start, end)`
+    std::vector<std::pair<off_t, io61_range_lock>> keep;
+    auto it = f->locks.upper_bound(start - f->lock_maxlen);
+    while (it != f->locks.end() && it->first < end) {
+        io61_range_lock& l = it->second;
+        if (l.end <= start || l.owner != self) {
+            ++it;
+            continue;
+        }
+        if (it->first < start) {
+            keep.push_back({it->first, {start, l.locktype, self}});
+        }
+        if (l.end > end) {
+            keep.push_back({end, {l.end, l.locktype, self}});
+        }
+        it = f->locks.erase(it);
+    }
+    f->locks.insert(keep.begin(), keep.end());
+
+    // Wake waiters whose ranges overlap the released range
+    for (io61_lock_waiter* w : f->lock_waiters) {
+        if (w->start < end && w->end > start) {
+            w->cv.notify_one();
+        }
+    }
     return 0;
 }
 
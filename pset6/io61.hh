@@ -32,6 +32,8 @@ ssize_t io61_pread(io61_file* f, unsigned char* buf, size_t sz,
 ssize_t io61_pwrite(io61_file* f, const unsigned char* buf, size_t sz,
                     off_t off);
 
+int io61_set_block_size(io61_file* f, size_t sz);
+
 int io61_try_lock(io61_file* f, off_t start, off_t len, int locktype);
 int io61_lock(io61_file* f, off_t start, off_t len, int locktype);
 int io61_unlock(io61_file* f, off_t start, off_t len);
@@ -66,7 +68,10 @@ struct io61_args {
     bool nonblocking = false;           // `-K`: nonblocking
     int nthreads = 1;                   // `-j`: number of threads
     int ndistinguished_threads = 0;     // `-J`: # distinguished threads
+    bool combine = false;               // `-H`: combine hot transfers
+    bool sync = false;                  // `-S`: sync ledger/log to disk
     size_t noperations = 0;             // `-n`: number of operations
+    const char* db_mode = nullptr;      // `-m`: database mode
 
     explicit io61_args(const char* opts, size_t block_size = 0);
 
@@ -79,7 +84,8 @@ struct io61_args {
 
     void usage();
 
-    // Call this after opening files (`-B`/`-D`).
+    // Call this after opening files (`-B`/`-D`, and `-b` for positioned
+    // io61 files).
     void after_open();
     void after_open(int fd, int mode);
     void after_open(io61_file* f, int mode);